@@ -1,8 +1,12 @@
 
+#include <errno.h>
+#include <unistd.h>
+
 #include "ice_internal_headers.h"
 
 #include "blob.h"
 #include "block.h"
+#include "file.h"
 
 Value from_str(const char* source)
 {
@@ -12,12 +16,19 @@ Value from_str(const char* source)
     return ptr_value(flat);
 }
 
-Value symbol(const char* source)
+Value blob_from_external(u8* data, u32 size, external_free_func free_func, void* context)
 {
-    u32 size = strlen(source);
-    Flat* flat = new_flat(SYMBOL_TYPE, size);
-    memcpy(flat->data, source, size);
-    return ptr_value(flat);
+    // Too large for one blob. The caller keeps ownership.
+    if (size > MAX_BLOB_SIZE)
+        return nil_value();
+
+    if (size == 0) {
+        if (free_func != NULL)
+            free_func(data, context);
+        return empty_blob();
+    }
+
+    return ptr_value(new_external(BLOB_TYPE, data, size, free_func, context));
 }
 
 void blob_print(Value blob)
@@ -46,3 +57,180 @@ char* as_cstr(Value blob)
     assert(false);
     return NULL;
 }
+
+// Write all of 'data', retrying after partial writes and interrupts.
+static bool write_all(int fd, const u8* data, u32 size)
+{
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+void blob_builder_start(BlobBuilder* builder, u32 capacity)
+{
+    if (capacity < 16)
+        capacity = 16;
+    if (capacity > MAX_BLOB_SIZE)
+        capacity = MAX_BLOB_SIZE;
+
+    builder->flat = new_flat(BLOB_TYPE, capacity);
+    builder->size = 0;
+    builder->capacity = capacity;
+    builder->fd = -1;
+    builder->failed = false;
+}
+
+void blob_builder_start_stream(BlobBuilder* builder, int fd, u32 capacity)
+{
+    blob_builder_start(builder, capacity);
+    builder->fd = fd;
+}
+
+void blob_builder_flush(BlobBuilder* builder)
+{
+    assert(builder->fd >= 0);
+
+    if (builder->size > 0 && !builder->failed)
+        builder->failed = !write_all(builder->fd, builder->flat->data, builder->size);
+    builder->size = 0;
+}
+
+// Whether 'size' more bytes still fit in one blob. If not, the builder has failed.
+static bool builder_fits(BlobBuilder* builder, u32 size)
+{
+    if (builder->fd < 0 && builder->size + size > MAX_BLOB_SIZE)
+        builder->failed = true;
+    return !builder->failed;
+}
+
+u8* blob_builder_reserve(BlobBuilder* builder, u32 size)
+{
+    u32 needed = builder->size + size;
+
+    if (needed > builder->capacity && builder->fd >= 0) {
+        blob_builder_flush(builder);
+        needed = size;
+    }
+
+    if (needed > builder->capacity) {
+        u32 capacity = builder->capacity * 2;
+        while (capacity < needed)
+            capacity *= 2;
+
+        // A reservation may run past the largest blob, as long as what's committed
+        // doesn't.
+        if (capacity > MAX_BLOB_SIZE)
+            capacity = needed > MAX_BLOB_SIZE ? needed : MAX_BLOB_SIZE;
+
+        builder->flat = realloc(builder->flat, sizeof(Flat) + capacity);
+        builder->capacity = capacity;
+    }
+
+    return builder->flat->data + builder->size;
+}
+
+bool blob_builder_commit(BlobBuilder* builder, u32 size)
+{
+    assert(builder->size + size <= builder->capacity);
+
+    if (!builder_fits(builder, size))
+        return false;
+    builder->size += size;
+    return true;
+}
+
+void blob_builder_append(BlobBuilder* builder, const u8* data, u32 size)
+{
+    if (builder->fd >= 0 && builder->size + size > builder->capacity) {
+        // Streaming: anything that doesn't fit goes straight out, without buffering.
+        blob_builder_flush(builder);
+        if (size > builder->capacity) {
+            if (!builder->failed)
+                builder->failed = !write_all(builder->fd, data, size);
+            return;
+        }
+    }
+
+    if (!builder_fits(builder, size))
+        return;
+    memcpy(blob_builder_reserve(builder, size), data, size);
+    builder->size += size;
+}
+
+void blob_builder_append_str(BlobBuilder* builder, const char* str)
+{
+    blob_builder_append(builder, (const u8*) str, strlen(str));
+}
+
+void blob_builder_append_u8(BlobBuilder* builder, u8 c)
+{
+    if (!builder_fits(builder, 1))
+        return;
+    *blob_builder_reserve(builder, 1) = c;
+    builder->size++;
+}
+
+void blob_builder_append_blob(BlobBuilder* builder, Value blob)
+{
+    if (!is_object(blob))
+        return;
+
+    if (builder->fd >= 0 && builder->size + block_size(blob) > builder->capacity) {
+        // Streaming and too big to buffer: write the sections out directly.
+        blob_builder_flush(builder);
+        if (!builder->failed)
+            builder->failed = !write_blob(builder->fd, blob);
+        return;
+    }
+
+    if (!builder_fits(builder, block_size(blob)))
+        return;
+
+    u8* dest = blob_builder_reserve(builder, block_size(blob));
+    for_each_section(blob, it) {
+        u32 size;
+        u8* section = iterator_get_section(&it, &size);
+        memcpy(dest, section, size);
+        dest += size;
+    }
+    builder->size += block_size(blob);
+}
+
+Value blob_builder_finish(BlobBuilder* builder)
+{
+    assert(builder->fd < 0);
+
+    Flat* flat = builder->flat;
+    builder->flat = NULL;
+
+    if (builder->failed) {
+        free(flat);
+        return nil_value();
+    }
+
+    if (builder->size == 0) {
+        free(flat);
+        return empty_blob();
+    }
+
+    if (builder->size != builder->capacity)
+        flat = realloc(flat, sizeof(Flat) + builder->size);
+    flat->header.size = builder->size;
+    return ptr_value(flat);
+}
+
+bool blob_builder_finish_stream(BlobBuilder* builder)
+{
+    blob_builder_flush(builder);
+    free(builder->flat);
+    builder->flat = NULL;
+    return !builder->failed;
+}
@@ -1,4 +1,43 @@
 
 #pragma once
 
+// Block sizes are 16 bits, so this is the most one blob can hold.
+#define MAX_BLOB_SIZE 0xffff
+
 Value from_str(const char* source);
+Value blob_from_external(u8* data, u32 size, external_free_func free_func, void* context);
+
+// Builds a blob in one growable buffer, finishing as a single flat. If the result
+// would be larger than MAX_BLOB_SIZE, the builder fails: later appends are dropped and
+// blob_builder_finish returns nil.
+//
+// A builder started with blob_builder_start_stream instead writes to a file
+// descriptor whenever the buffer fills, so it never holds more than 'capacity' bytes.
+typedef struct BlobBuilder {
+    Flat* flat;
+    u32 size;
+    u32 capacity;
+    int fd; // -1 when not streaming
+    bool failed; // a write failed, or the result got too large
+} BlobBuilder;
+
+void blob_builder_start(BlobBuilder* builder, u32 capacity);
+void blob_builder_start_stream(BlobBuilder* builder, int fd, u32 capacity);
+void blob_builder_append(BlobBuilder* builder, const u8* data, u32 size);
+void blob_builder_append_str(BlobBuilder* builder, const char* str);
+void blob_builder_append_u8(BlobBuilder* builder, u8 c);
+void blob_builder_append_blob(BlobBuilder* builder, Value blob);
+
+// Make room for 'size' more bytes and return where they go. Follow with
+// blob_builder_commit to say how many were written. Only the committed bytes count
+// toward MAX_BLOB_SIZE, so a generous reservation near the limit is fine; commit
+// returns false if the bytes don't fit.
+u8* blob_builder_reserve(BlobBuilder* builder, u32 size);
+bool blob_builder_commit(BlobBuilder* builder, u32 size);
+
+Value blob_builder_finish(BlobBuilder* builder);
+
+// Streaming only. finish_stream flushes and frees the buffer, and returns false if
+// any write failed.
+void blob_builder_flush(BlobBuilder* builder);
+bool blob_builder_finish_stream(BlobBuilder* builder);
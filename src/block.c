@@ -4,16 +4,26 @@
 #include "value.h"
 #include "iterator.h"
 #include "block.h"
+#include "table.h"
+#include "text.h"
 
 #define min(x,y) ((x) < (y) ? (x) : (y))
 
 Flat* new_flat(u8 logical_type, u16 size)
 {
-    Flat* flat = malloc(sizeof(Flat) + size);
+    return new_flat_with_trailer(logical_type, size, 0);
+}
+
+Flat* new_flat_with_trailer(u8 logical_type, u16 size, u32 trailer_size)
+{
+    Flat* flat = malloc(sizeof(Flat) + size + trailer_size);
     flat->header.block_type = FLAT_BLOCK;
     flat->header.logical_type = logical_type;
+    flat->header.interned = 0;
     flat->header.refcount = 1;
+    flat->header.layout = 0;
     flat->header.size = size;
+    flat->header.hash = 0;
     return flat;
 }
 
@@ -22,8 +32,11 @@ Slice* new_slice(u8 logical_type, u16 start_pos, u16 size, Value base)
     Slice* slice = (Slice*) malloc(sizeof(Slice));
     slice->header.block_type = SLICE_BLOCK;
     slice->header.logical_type = logical_type;
+    slice->header.interned = 0;
     slice->header.refcount = 1;
+    slice->header.layout = 0;
     slice->header.size = size;
+    slice->header.hash = 0;
     slice->start_pos = start_pos;
     slice->base = base;
     return slice;
@@ -37,13 +50,49 @@ Node* new_node(u8 logical_type, Value left, Value right)
     Node* node = (Node*) malloc(sizeof(Node));
     node->header.block_type = NODE_BLOCK;
     node->header.logical_type = logical_type;
+    node->header.interned = 0;
     node->header.refcount = 1;
+    node->header.layout = 0;
     node->header.size = block_size(left) + block_size(right);
+    node->header.hash = 0;
     node->left = left;
     node->right = right;
+    node->char_count = logical_type == TEXT_TYPE ? char_length(left) + char_length(right) : 0;
     return node;
 }
 
+Mapped* new_mapped(u8 logical_type, u8* data, u16 size, void* region, u64 region_size)
+{
+    Mapped* mapped = (Mapped*) malloc(sizeof(Mapped));
+    mapped->header.block_type = MAPPED_BLOCK;
+    mapped->header.logical_type = logical_type;
+    mapped->header.interned = 0;
+    mapped->header.refcount = 1;
+    mapped->header.layout = 0;
+    mapped->header.size = size;
+    mapped->header.hash = 0;
+    mapped->data = data;
+    mapped->region = region;
+    mapped->region_size = region_size;
+    return mapped;
+}
+
+External* new_external(u8 logical_type, u8* data, u16 size, external_free_func free_func, void* context)
+{
+    External* external = (External*) malloc(sizeof(External));
+    external->header.block_type = EXTERNAL_BLOCK;
+    external->header.logical_type = logical_type;
+    external->header.interned = 0;
+    external->header.refcount = 1;
+    external->header.layout = 0;
+    external->header.size = size;
+    external->header.hash = 0;
+    external->data = data;
+    external->free_func = free_func;
+    external->context = context;
+    return external;
+}
+
 bool is_flat_block(Value value)
 {
     return is_object(value) && value.object->block_type == FLAT_BLOCK;
@@ -59,6 +108,30 @@ bool is_node_block(Value value)
     return is_object(value) && value.object->block_type == NODE_BLOCK;
 }
 
+bool is_mapped_block(Value value)
+{
+    return is_object(value) && value.object->block_type == MAPPED_BLOCK;
+}
+
+bool is_external_block(Value value)
+{
+    return is_object(value) && value.object->block_type == EXTERNAL_BLOCK;
+}
+
+bool is_leaf_block(Value value)
+{
+    if (!is_object(value))
+        return false;
+
+    switch (value.object->block_type) {
+    case FLAT_BLOCK:
+    case MAPPED_BLOCK:
+    case EXTERNAL_BLOCK:
+        return true;
+    }
+    return false;
+}
+
 u16 block_size(Value value)
 {
     if (is_object(value))
@@ -76,6 +149,9 @@ u8* block_get(Value obj, u32 offset)
     switch (obj.object->block_type) {
     case FLAT_BLOCK:
         return obj.flat->data + offset;
+    case MAPPED_BLOCK:
+    case EXTERNAL_BLOCK:
+        return leaf_data(obj) + offset;
     case SLICE_BLOCK:
         return block_get(obj.slice->base, offset + obj.slice->start_pos);
     case NODE_BLOCK: {
@@ -101,6 +177,8 @@ Value prepend(Value list, Value prefix)
 
 u32 length(Value list)
 {
+    if (is_hashtable(list))
+        return block_size(list) / (sizeof(Value) * 2);
     if (is_object(list))
         return block_size(list) / sizeof(Value);
     return 0;
@@ -111,6 +189,15 @@ Value concat(Value left /*consumed*/, Value right /*consumed*/)
     check_value(left);
     check_value(right);
 
+    // Text stays valid UTF-8, so a blob concatenated onto it is checked first.
+    if (is_text(left) && !is_text(right)) {
+        right = text_operand(right);
+        if (is_nil(right)) {
+            decref(left);
+            return nil_value();
+        }
+    }
+
     if (is_empty(left))
         return right;
     if (is_empty(right))
@@ -121,49 +208,69 @@ Value concat(Value left /*consumed*/, Value right /*consumed*/)
     return ptr_value(new_node(left.object->logical_type, left, right));
 }
 
+Value concat_balanced(Value* parts /*consumed*/, u32 count)
+{
+    if (count == 0)
+        return empty_blob();
+    if (count == 1)
+        return parts[0];
+    return concat(concat_balanced(parts, count / 2),
+        concat_balanced(parts + count / 2, count - count / 2));
+}
+
 u8* append_writeable_section(Value* obj, u32 size)
 {
+    // The section is filled in after it's attached, so it can't be checked as text.
+    assert(!is_text(*obj));
+
     Flat* section = new_flat(get_logical_type(*obj), size);
     *obj = concat(*obj, ptr_value(section));
     return section->data;
 }
 
+// Appended bytes are copied before the section is attached, so that text can check them.
+static Value append_copy(Value obj /*consumed*/, const void* bytes, u32 size)
+{
+    Flat* section = new_flat(is_text(obj) ? BLOB_TYPE : get_logical_type(obj), size);
+    memcpy(section->data, bytes, size);
+    return concat(obj, ptr_value(section));
+}
+
 Value append_u8(Value obj /*consumed*/, u8 val)
 {
-    u8* dest = append_writeable_section(&obj, 1);
-    *dest = val;
-    return obj;
+    return append_copy(obj, &val, 1);
 }
 
 Value append_bytes_len(Value obj, const u8* bytes, u32 size)
 {
-    u8* dest = append_writeable_section(&obj, size);
-    memcpy(dest, bytes, size);
-    return obj;
+    return append_copy(obj, bytes, size);
 }
 
 Value append_str_len(Value obj, const char* str, u32 size)
 {
-    u8* dest = append_writeable_section(&obj, size);
-    memcpy(dest, str, size);
-    return obj;
+    return append_copy(obj, str, size);
 }
 
 Value append_str(Value obj, const char* str)
 {
-    size_t size = strlen(str);
-    u8* dest = append_writeable_section(&obj, size);
-    memcpy(dest, str, size);
-    return obj;
+    return append_copy(obj, str, strlen(str));
 }
 
 Value byte_slice(Value base, u32 start_offset, u32 size)
 {
-    // Simplify slice-of-slice
-    
-    if (is_slice_block(base))
-        return byte_slice(base.slice->base, base.slice->start_pos + start_offset,
-                min(size, base.slice->header.size));
+    // A slice of a slice refers straight to the underlying block, and keeps the outer
+    // slice's logical type.
+    if (is_slice_block(base)) {
+        u32 base_size = block_size(base);
+        if (start_offset > base_size)
+            start_offset = base_size;
+        size = min(size, base_size - start_offset);
+
+        Value result = ptr_value(new_slice(get_logical_type(base),
+            base.slice->start_pos + start_offset, size, incref(base.slice->base)));
+        decref(base);
+        return result;
+    }
 
     return ptr_value(new_slice(get_logical_type(base), start_offset, size, base));
 }
@@ -180,14 +287,29 @@ Value slice(Value base, u32 start_offset, u32 size)
     return byte_slice(base, start_offset, size);
 }
 
-Value flatten(Value val)
+// Size of the index stored after a flat's data, if it has one.
+static u32 block_trailer_size(Value val)
 {
-    if (!is_object(val))
-        return val;
-    if (val.object->block_type == FLAT_BLOCK)
-        return val;
+    if (!is_flat_block(val))
+        return 0;
+
+    switch (val.object->logical_type) {
+    case TABLE_TYPE:
+        return table_trailer_size(val);
+    case TEXT_TYPE:
+        return text_trailer_size(val);
+    }
+    return 0;
+}
 
-    Flat* flat = new_flat(val.object->logical_type, val.object->size);
+// Copy the contents of 'val' into a new flat. Items of lists and tables are
+// incref'd, and tables and texts keep their index.
+static Flat* copy_to_new_flat(Value val)
+{
+    u16 size = val.object->size;
+    u32 trailer_size = block_trailer_size(val);
+    Flat* flat = new_flat_with_trailer(val.object->logical_type, size, trailer_size);
+    flat->header.layout = val.object->layout;
 
     size_t dest_offset = 0;
     for_each_section(val, it) {
@@ -197,5 +319,42 @@ Value flatten(Value val)
         dest_offset += source_size;
     }
 
+    if (trailer_size != 0)
+        memcpy(flat->data + size, val.flat->data + size, trailer_size);
+
+    if (val.object->logical_type == LIST_TYPE || val.object->logical_type == TABLE_TYPE)
+        for (u32 pos=0; pos < size; pos += sizeof(Value))
+            incref(*(Value*) (flat->data + pos));
+
+    return flat;
+}
+
+Value flatten(Value val)
+{
+    if (!is_object(val))
+        return val;
+    if (val.object->block_type == FLAT_BLOCK)
+        return val;
+
+    // Same content, so the same hash.
+    Flat* flat = copy_to_new_flat(val);
+    flat->header.hash = val.object->hash;
+    decref(val);
+    return ptr_value(flat);
+}
+
+Value writeable_flat(Value val)
+{
+    if (!is_object(val))
+        return val;
+
+    // The caller is about to change the contents, so any cached hash goes.
+    if (is_flat_block(val) && is_writeable_object(val)) {
+        val.object->hash = 0;
+        return val;
+    }
+
+    Flat* flat = copy_to_new_flat(val);
+    decref(val);
     return ptr_value(flat);
 }
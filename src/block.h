@@ -2,12 +2,35 @@
 #pragma once
 
 Flat* new_flat(u8 logical_type, u16 size);
+
+// Allocate a flat with 'trailer_size' extra bytes after the data. The trailer is not
+// counted in the block size, so iterators and slices never see it.
+Flat* new_flat_with_trailer(u8 logical_type, u16 size, u32 trailer_size);
 Slice* new_slice(u8 logical_type, u16 start_pos, u16 size, Value base);
 Node* new_node(u8 logical_type, Value left, Value right);
+Mapped* new_mapped(u8 logical_type, u8* data, u16 size, void* region, u64 region_size);
+External* new_external(u8 logical_type, u8* data, u16 size, external_free_func free_func, void* context);
 
 bool is_flat_block(Value value);
 bool is_slice_block(Value value);
 bool is_node_block(Value value);
+bool is_mapped_block(Value value);
+bool is_external_block(Value value);
+
+// Leaf blocks (flat, mapped and external) hold their bytes directly; other blocks
+// refer to other blocks.
+bool is_leaf_block(Value value);
+
+static inline u8* leaf_data(Value leaf)
+{
+    switch (leaf.object->block_type) {
+    case MAPPED_BLOCK:
+        return leaf.mapped->data;
+    case EXTERNAL_BLOCK:
+        return leaf.external->data;
+    }
+    return leaf.flat->data;
+}
 
 u16 block_size(Value value);
 
@@ -20,7 +43,15 @@ Value append_str(Value obj /*consumed*/, const char* str);
 Value append_str_len(Value obj /*consumed*/, const char* str, u32 size);
 Value concat(Value left /*consumed*/, Value right /*consumed*/);
 
+// Concatenate 'count' blobs as a balanced tree, so the depth grows with log(count).
+Value concat_balanced(Value* parts /*consumed*/, u32 count);
+
 Value byte_slice(Value base /*consumed*/, u32 start_offset, u32 size);
 Value slice(Value base /*consumed*/, u32 start_offset, u32 size);
-Value flatten(Value val);
+Value flatten(Value val /*consumed*/);
+
+// Returns a flat block that the caller may write into: 'val' itself if it's already
+// an unshared, non-interned flat, otherwise a copy. Either way the cached hash is
+// cleared, so callers don't need to.
+Value writeable_flat(Value val /*consumed*/);
 
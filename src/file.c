@@ -0,0 +1,543 @@
+
+// For fstat() and O_CLOEXEC
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ice_internal_headers.h"
+
+#include "blob.h"
+#include "block.h"
+#include "file.h"
+#include "hash.h"
+#include "list.h"
+#include "parallel.h"
+#include "uring.h"
+
+// Files are read into chunks of this size, which become the sections of the result.
+#define READ_CHUNK_SIZE 16384
+#define MAX_READ_THREADS 32
+#define MAX_READ_CHUNKS ((MAX_BLOB_SIZE + READ_CHUNK_SIZE - 1) / READ_CHUNK_SIZE)
+
+// Sections per writev call. This is IOV_MAX on Linux and the BSDs.
+#define WRITE_BATCH 1024
+
+// Write every buffer in 'iov', continuing after partial writes. The iovec array is
+// modified as it goes.
+static bool writev_all(int fd, struct iovec* iov, int count)
+{
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        while (count > 0 && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0) {
+            iov->iov_base = (u8*) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+bool write_blob(int fd, Value blob)
+{
+    if (!is_object(blob))
+        return true;
+
+    // Ropes are written from their sections in place, never flattened.
+    struct iovec iov[WRITE_BATCH];
+    int count = 0;
+
+    for_each_section(blob, it) {
+        u32 size;
+        u8* section = iterator_get_section(&it, &size);
+        if (size == 0)
+            continue;
+
+        iov[count].iov_base = section;
+        iov[count].iov_len = size;
+        count++;
+
+        if (count == WRITE_BATCH) {
+            if (!writev_all(fd, iov, count)) {
+                iterator_stop(&it);
+                return false;
+            }
+            count = 0;
+        }
+    }
+
+    return writev_all(fd, iov, count);
+}
+
+// Read until 'size' bytes or end of input. Returns the number read, or -1 on error.
+static ssize_t read_full(int fd, u8* dest, u32 size)
+{
+    u32 total = 0;
+    while (total < size) {
+        ssize_t count = read(fd, dest + total, size - total);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (count == 0)
+            break;
+        total += count;
+    }
+    return total;
+}
+
+// True if there is nothing more to read. Used to notice a file that is larger than
+// expected, or a stream that is larger than one blob.
+static bool at_end(int fd)
+{
+    u8 extra;
+    return read_full(fd, &extra, 1) == 0;
+}
+
+// Shrink a chunk to the bytes that were actually read, or free it if it's empty.
+static Value finish_chunk(Flat* chunk, u32 size)
+{
+    if (size == 0) {
+        free(chunk);
+        return empty_blob();
+    }
+    if (size != chunk->header.size) {
+        chunk = realloc(chunk, sizeof(Flat) + size);
+        chunk->header.size = size;
+    }
+    return ptr_value(chunk);
+}
+
+static Value read_single_flat(int fd, u32 expected_size)
+{
+    Flat* flat = new_flat(BLOB_TYPE, expected_size);
+    ssize_t count = read_full(fd, flat->data, expected_size);
+    if (count < 0) {
+        free(flat);
+        return nil_value();
+    }
+    return finish_chunk(flat, count);
+}
+
+// Read up to 'expected_size' bytes into chunks with one readv per pass. Chunks that
+// come back short at end of file are trimmed, and the result is a balanced rope of
+// the chunks, so nothing is copied after the read. If 'must_end' is set, anything
+// left after 'expected_size' bytes is an error.
+static Value read_chunks(int fd, u32 expected_size, bool must_end)
+{
+    Flat* chunks[MAX_READ_CHUNKS];
+    struct iovec iov[MAX_READ_CHUNKS];
+
+    int chunk_count = 0;
+    for (u32 capacity = 0; capacity < expected_size; chunk_count++) {
+        u32 size = expected_size - capacity;
+        if (size > READ_CHUNK_SIZE)
+            size = READ_CHUNK_SIZE;
+        chunks[chunk_count] = new_flat(BLOB_TYPE, size);
+        iov[chunk_count].iov_base = chunks[chunk_count]->data;
+        iov[chunk_count].iov_len = size;
+        capacity += size;
+    }
+
+    u32 total = 0;
+    int first = 0;
+    bool failed = false;
+
+    while (first < chunk_count) {
+        ssize_t count = readv(fd, iov + first, chunk_count - first);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            failed = true;
+            break;
+        }
+        if (count == 0)
+            break;
+
+        total += count;
+        while (first < chunk_count && (size_t) count >= iov[first].iov_len) {
+            count -= iov[first].iov_len;
+            first++;
+        }
+        if (first < chunk_count) {
+            iov[first].iov_base = (u8*) iov[first].iov_base + count;
+            iov[first].iov_len -= count;
+        }
+    }
+
+    if (!failed && must_end && total == expected_size && !at_end(fd))
+        failed = true;
+
+    if (failed) {
+        for (int i=0; i < chunk_count; i++)
+            free(chunks[i]);
+        return nil_value();
+    }
+
+    Value parts[MAX_READ_CHUNKS];
+    int part_count = 0;
+    u32 remaining = total;
+    for (int i=0; i < chunk_count; i++) {
+        u32 size = remaining < chunks[i]->header.size ? remaining : chunks[i]->header.size;
+        remaining -= size;
+        Value part = finish_chunk(chunks[i], size);
+        if (!is_empty_blob(part))
+            parts[part_count++] = part;
+    }
+
+    return concat_balanced(parts, part_count);
+}
+
+static Value map_file(int fd, u32 size)
+{
+    void* region = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (region == MAP_FAILED)
+        return nil_value();
+    return ptr_value(new_mapped(BLOB_TYPE, (u8*) region, size, region, size));
+}
+
+void unmap_region(void* region, u64 size)
+{
+    munmap(region, size);
+}
+
+Value read_fd(int fd, u32 flags)
+{
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+        return nil_value();
+
+    // Regular files are read up to their size at the time of the fstat. Anything
+    // else (and files that report a size of 0, like most of /proc) is read until end
+    // of input, and fails if that's more than one blob can hold.
+    if (S_ISREG(info.st_mode) && info.st_size > 0) {
+        if (info.st_size > MAX_BLOB_SIZE)
+            return nil_value();
+        if (flags & READ_MAPPED)
+            return map_file(fd, info.st_size);
+        if (flags & READ_SINGLE_FLAT)
+            return read_single_flat(fd, info.st_size);
+        return read_chunks(fd, info.st_size, false);
+    }
+
+    Value contents = read_chunks(fd, MAX_BLOB_SIZE, true);
+    if (flags & READ_SINGLE_FLAT)
+        contents = flatten(contents);
+    return contents;
+}
+
+Value read_path(const char* path, u32 flags)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return nil_value();
+
+    Value contents = read_fd(fd, flags);
+    close(fd);
+    return contents;
+}
+
+Value read_file_with_flags(Value filename /*consumed*/, u32 flags)
+{
+    Value path = to_cstr(filename);
+    Value contents = read_path((const char*) path.flat->data, flags);
+    decref(path);
+    return contents;
+}
+
+Value read_file(Value filename /*consumed*/)
+{
+    return read_file_with_flags(filename, 0);
+}
+
+typedef struct ReadFilesTask {
+    const char** paths;
+    Value* results;
+    u32 count;
+} ReadFilesTask;
+
+static void read_files_worker(void* arg)
+{
+    ReadFilesTask* task = (ReadFilesTask*) arg;
+    for (u32 i=0; i < task->count; i++)
+        task->results[i] = read_path(task->paths[i], 0);
+}
+
+void read_files_threaded(const char** paths, Value* results, u32 count)
+{
+    // Files are small and the time is mostly waiting on the disk, so use more
+    // threads than cores.
+    int thread_count = parallel_thread_count() * 4;
+    if (thread_count > MAX_READ_THREADS)
+        thread_count = MAX_READ_THREADS;
+    if (thread_count > (int) count)
+        thread_count = count;
+    if (thread_count < 1)
+        return;
+
+    ReadFilesTask tasks[MAX_READ_THREADS];
+    void* args[MAX_READ_THREADS];
+    u32 start = 0;
+    for (int i=0; i < thread_count; i++) {
+        u32 end = (u64) count * (i + 1) / thread_count;
+        tasks[i].paths = paths + start;
+        tasks[i].results = results + start;
+        tasks[i].count = end - start;
+        args[i] = &tasks[i];
+        start = end;
+    }
+
+    parallel_run(read_files_worker, args, thread_count);
+}
+
+Value read_files(Value paths /*consumed*/)
+{
+    u32 count = length(paths);
+    if (count == 0) {
+        decref(paths);
+        return empty_list();
+    }
+
+    // Paths are converted on this thread; workers only see the C strings.
+    Value* cstrs = malloc(sizeof(Value) * count);
+    const char** path_strs = malloc(sizeof(char*) * count);
+    u32 i = 0;
+    for_each_list_item(paths, it) {
+        cstrs[i] = to_cstr(incref(iterator_get_val(&it)));
+        path_strs[i] = (const char*) cstrs[i].flat->data;
+        i++;
+    }
+
+    Flat* result = new_flat(LIST_TYPE, sizeof(Value) * count);
+    Value* results = (Value*) result->data;
+
+    if (!read_files_uring(path_strs, results, count))
+        read_files_threaded(path_strs, results, count);
+
+    for (u32 i=0; i < count; i++)
+        decref(cstrs[i]);
+    free(cstrs);
+    free(path_strs);
+    decref(paths);
+    return ptr_value(result);
+}
+
+#define PATH_BUFFER_SIZE 4096
+
+// The sidecar cache is '<filename>.hash', holding a 64-bit hash of the contents last
+// written, and enough of the file's stat to notice if it was replaced or resized since.
+// A match skips comparing the bytes, so the hash is wide enough that a collision
+// between same-sized contents isn't a practical concern; a 32-bit hashcode would be.
+typedef struct HashSidecar {
+    u32 magic;
+    u32 reserved;
+    u64 hash;
+    u64 size;
+    u64 inode;
+    i64 mtime_sec;
+    i64 mtime_nsec;
+} HashSidecar;
+
+#define HASH_SIDECAR_MAGIC 0x32687369 // "ish2"
+
+static void sidecar_from_stat(HashSidecar* sidecar, u64 hash, struct stat* info)
+{
+    memset(sidecar, 0, sizeof(HashSidecar));
+    sidecar->magic = HASH_SIDECAR_MAGIC;
+    sidecar->hash = hash;
+    sidecar->size = info->st_size;
+    sidecar->inode = info->st_ino;
+    sidecar->mtime_sec = info->st_mtim.tv_sec;
+    sidecar->mtime_nsec = info->st_mtim.tv_nsec;
+}
+
+static bool read_sidecar(const char* path, HashSidecar* sidecar)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool ok = read_full(fd, (u8*) sidecar, sizeof(HashSidecar)) == sizeof(HashSidecar);
+    close(fd);
+    return ok && sidecar->magic == HASH_SIDECAR_MAGIC;
+}
+
+static void write_sidecar(const char* path, HashSidecar* sidecar)
+{
+    // A short write leaves a sidecar that read_sidecar rejects, so it's not checked.
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0)
+        return;
+    ssize_t written = write(fd, sidecar, sizeof(HashSidecar));
+    (void) written;
+    close(fd);
+}
+
+static bool path_with_suffix(char* dest, u32 dest_size, const char* path, const char* suffix)
+{
+    return snprintf(dest, dest_size, "%s%s", path, suffix) < (int) dest_size;
+}
+
+// Compare the file against 'contents' through a mapping of the file, one section of
+// 'contents' at a time, stopping at the first difference.
+static bool file_matches(int fd, u32 size, Value contents)
+{
+    // The file may have changed since it was checked by path. Mapping past its end
+    // would fault, so the size is checked again on the open file.
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size != size)
+        return false;
+
+    if (size == 0)
+        return true;
+
+    u8* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED)
+        return false;
+
+    bool matches = true;
+    u32 offset = 0;
+    for_each_section(contents, it) {
+        u32 section_size;
+        u8* section = iterator_get_section(&it, &section_size);
+        if (memcmp(mapped + offset, section, section_size) != 0) {
+            matches = false;
+            iterator_stop(&it);
+            break;
+        }
+        offset += section_size;
+    }
+
+    munmap(mapped, size);
+    return matches;
+}
+
+// The process umask. umask() can only be read by setting it, which would race with
+// other threads creating files, so it's read from /proc where that's available.
+static mode_t current_umask()
+{
+    mode_t mask = 022;
+    FILE* status = fopen("/proc/self/status", "re");
+    if (status == NULL)
+        return mask;
+
+    char line[128];
+    unsigned int value;
+    while (fgets(line, sizeof(line), status) != NULL) {
+        if (sscanf(line, "Umask: %o", &value) == 1) {
+            mask = value;
+            break;
+        }
+    }
+    fclose(status);
+    return mask;
+}
+
+// Write to a temporary file next to the target, then rename it over the target, so
+// readers see either the old contents or the new, never a partial write. The temporary
+// name is unique, so concurrent writers of the same path don't share it, and the data
+// is synced before the rename so a crash can't leave the target empty.
+static bool replace_file(const char* path, Value contents, struct stat* existing)
+{
+    char temp_path[PATH_BUFFER_SIZE];
+    if (!path_with_suffix(temp_path, sizeof(temp_path), path, ".XXXXXX"))
+        return false;
+
+    int fd = mkstemp(temp_path);
+    if (fd < 0)
+        return false;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    // mkstemp creates the file as 0600. Keep the target's mode, or give a new file
+    // the mode that open() would have.
+    mode_t mode = existing != NULL ? existing->st_mode & 07777 : 0666 & ~current_umask();
+
+    bool ok = write_blob(fd, contents);
+    ok = ok && fchmod(fd, mode) == 0;
+    ok = ok && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(temp_path, path) == 0;
+
+    if (!ok)
+        unlink(temp_path);
+    return ok;
+}
+
+Value write_file_if_different_with_flags(Value filename /*consumed*/, Value contents, u32 flags)
+{
+    assert(is_blob(contents) || is_text(contents));
+
+    Value path = to_cstr(filename);
+    const char* path_str = (const char*) path.flat->data;
+    u32 size = block_size(contents);
+
+    bool use_sidecar = (flags & WRITE_HASH_SIDECAR) != 0;
+    char sidecar_path[PATH_BUFFER_SIZE];
+    u64 hash = 0;
+    HashSidecar sidecar;
+    memset(&sidecar, 0, sizeof(sidecar));
+
+    if (use_sidecar) {
+        use_sidecar = path_with_suffix(sidecar_path, sizeof(sidecar_path), path_str, ".hash");
+        hash = hashcode64(contents);
+    }
+
+    struct stat info;
+    bool exists = stat(path_str, &info) == 0 && S_ISREG(info.st_mode);
+    bool same = false;
+
+    if (exists && info.st_size == size) {
+        HashSidecar expected;
+        if (use_sidecar && read_sidecar(sidecar_path, &sidecar)) {
+            sidecar_from_stat(&expected, hash, &info);
+            same = memcmp(&sidecar, &expected, sizeof(HashSidecar)) == 0;
+        }
+
+        if (!same) {
+            int fd = open(path_str, O_RDONLY | O_CLOEXEC);
+            if (fd >= 0) {
+                same = file_matches(fd, size, contents);
+                close(fd);
+            }
+        }
+    }
+
+    Value result = false_value();
+
+    if (!same) {
+        if (replace_file(path_str, contents, exists ? &info : NULL))
+            result = true_value();
+        else
+            result = nil_value();
+    }
+
+    if (use_sidecar && !is_nil(result) && stat(path_str, &info) == 0) {
+        HashSidecar updated;
+        sidecar_from_stat(&updated, hash, &info);
+        if (memcmp(&sidecar, &updated, sizeof(HashSidecar)) != 0)
+            write_sidecar(sidecar_path, &updated);
+    }
+
+    decref(path);
+    return result;
+}
+
+Value write_file_if_different(Value filename /*consumed*/, Value contents)
+{
+    return write_file_if_different_with_flags(filename, contents, 0);
+}
@@ -0,0 +1,17 @@
+// Copyright (c) Andrew Fischer. See LICENSE file for license terms.
+
+#pragma once
+
+bool write_blob(int fd, Value blob);
+
+Value read_fd(int fd, u32 flags);
+Value read_path(const char* path, u32 flags);
+Value read_file_with_flags(Value filename /*consumed*/, u32 flags);
+Value read_files(Value paths /*consumed*/);
+
+// The thread pool fallback of read_files, used when io_uring isn't available.
+void read_files_threaded(const char** paths, Value* results, u32 count);
+
+Value write_file_if_different_with_flags(Value filename /*consumed*/, Value contents, u32 flags);
+
+void unmap_region(void* region, u64 size);
@@ -0,0 +1,370 @@
+
+#include "ice_internal_headers.h"
+
+#include "format.h"
+
+// Integers are written two digits at a time from a table of "00".."99".
+//
+// Floats use the Ryu algorithm (Ulf Adams, 2018): the exact interval of decimals that
+// round to the float is scaled by a precomputed power of 5, and digits are removed
+// while both ends of the interval still agree. That yields the shortest digit string
+// that parses back to the same float, without any big-number arithmetic.
+
+static const char digit_pairs[200] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static u32 decimal_length(u64 value)
+{
+    u32 length = 1;
+    while (value >= 10) {
+        value /= 10;
+        length++;
+    }
+    return length;
+}
+
+// Write exactly 'length' digits of 'value', right to left.
+static void write_digits(char* dest, u64 value, u32 length)
+{
+    char* pos = dest + length;
+
+    while (value >= 100) {
+        u32 pair = (value % 100) * 2;
+        value /= 100;
+        pos -= 2;
+        memcpy(pos, digit_pairs + pair, 2);
+    }
+
+    if (value >= 10) {
+        pos -= 2;
+        memcpy(pos, digit_pairs + value * 2, 2);
+    } else {
+        *(--pos) = '0' + value;
+    }
+}
+
+u32 format_int(char* dest, i64 value)
+{
+    u32 sign = 0;
+    u64 magnitude = value;
+
+    if (value < 0) {
+        dest[0] = '-';
+        magnitude = 0 - magnitude;
+        sign = 1;
+    }
+
+    u32 length = decimal_length(magnitude);
+    write_digits(dest + sign, magnitude, length);
+    return sign + length;
+}
+
+#define FLOAT_MANTISSA_BITS 23
+#define FLOAT_BIAS 127
+#define FLOAT_POW5_INV_BITCOUNT 59
+#define FLOAT_POW5_BITCOUNT 61
+
+// floor(2^(bits(5^q) - 1 + 59) / 5^q) + 1
+static const u64 float_pow5_inv_split[31] = {
+    576460752303423489ull, 461168601842738791ull, 368934881474191033ull,
+    295147905179352826ull, 472236648286964522ull, 377789318629571618ull,
+    302231454903657294ull, 483570327845851670ull, 386856262276681336ull,
+    309485009821345069ull, 495176015714152110ull, 396140812571321688ull,
+    316912650057057351ull, 507060240091291761ull, 405648192073033409ull,
+    324518553658426727ull, 519229685853482763ull, 415383748682786211ull,
+    332306998946228969ull, 531691198313966350ull, 425352958651173080ull,
+    340282366920938464ull, 544451787073501542ull, 435561429658801234ull,
+    348449143727040987ull, 557518629963265579ull, 446014903970612463ull,
+    356811923176489971ull, 570899077082383953ull, 456719261665907162ull,
+    365375409332725730ull,
+};
+
+// The top 61 bits of 5^i.
+static const u64 float_pow5_split[47] = {
+    1152921504606846976ull, 1441151880758558720ull, 1801439850948198400ull,
+    2251799813685248000ull, 1407374883553280000ull, 1759218604441600000ull,
+    2199023255552000000ull, 1374389534720000000ull, 1717986918400000000ull,
+    2147483648000000000ull, 1342177280000000000ull, 1677721600000000000ull,
+    2097152000000000000ull, 1310720000000000000ull, 1638400000000000000ull,
+    2048000000000000000ull, 1280000000000000000ull, 1600000000000000000ull,
+    2000000000000000000ull, 1250000000000000000ull, 1562500000000000000ull,
+    1953125000000000000ull, 1220703125000000000ull, 1525878906250000000ull,
+    1907348632812500000ull, 1192092895507812500ull, 1490116119384765625ull,
+    1862645149230957031ull, 1164153218269348144ull, 1455191522836685180ull,
+    1818989403545856475ull, 2273736754432320594ull, 1421085471520200371ull,
+    1776356839400250464ull, 2220446049250313080ull, 1387778780781445675ull,
+    1734723475976807094ull, 2168404344971008868ull, 1355252715606880542ull,
+    1694065894508600678ull, 2117582368135750847ull, 1323488980084844279ull,
+    1654361225106055349ull, 2067951531382569187ull, 1292469707114105741ull,
+    1615587133892632177ull, 2019483917365790221ull,
+};
+
+// ceil(log2(5^e)), or 1 for e == 0.
+static i32 pow5_bits(i32 e)
+{
+    return (i32) (((u32) e * 1217359) >> 19) + 1;
+}
+
+// floor(log10(2^e))
+static u32 log10_pow2(i32 e)
+{
+    return ((u32) e * 78913) >> 18;
+}
+
+// floor(log10(5^e))
+static u32 log10_pow5(i32 e)
+{
+    return ((u32) e * 732923) >> 20;
+}
+
+static u32 pow5_factor(u32 value)
+{
+    u32 count = 0;
+    while (value % 5 == 0) {
+        value /= 5;
+        count++;
+    }
+    return count;
+}
+
+static bool multiple_of_pow5(u32 value, u32 p)
+{
+    return pow5_factor(value) >= p;
+}
+
+static bool multiple_of_pow2(u32 value, u32 p)
+{
+    return (value & ((1u << p) - 1)) == 0;
+}
+
+static u32 mul_shift(u32 m, u64 factor, i32 shift)
+{
+    u64 low = (u64) m * (u32) factor;
+    u64 high = (u64) m * (factor >> 32);
+    u64 sum = (low >> 32) + high;
+    return (u32) (sum >> (shift - 32));
+}
+
+// Find the shortest 'digits * 10^exponent' that rounds to the float with the given
+// IEEE mantissa and exponent fields.
+static void shortest_decimal(u32 ieee_mantissa, u32 ieee_exponent, u32* digits, i32* exponent)
+{
+    i32 e2;
+    u32 m2;
+    if (ieee_exponent == 0) {
+        e2 = 1 - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = (i32) ieee_exponent - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+        m2 = (1u << FLOAT_MANTISSA_BITS) | ieee_mantissa;
+    }
+
+    // Round-half-even on parse means the interval bounds are inclusive for even mantissas.
+    bool accept_bounds = (m2 & 1) == 0;
+
+    // The value and the midpoints to its neighbours, scaled by 4.
+    u32 mv = 4 * m2;
+    u32 mp = 4 * m2 + 2;
+    u32 mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+    u32 mm = 4 * m2 - 1 - mm_shift;
+
+    u32 vr, vp, vm;
+    i32 e10;
+    bool vm_trailing_zeros = false;
+    bool vr_trailing_zeros = false;
+    u8 last_removed_digit = 0;
+
+    if (e2 >= 0) {
+        u32 q = log10_pow2(e2);
+        e10 = q;
+        i32 k = FLOAT_POW5_INV_BITCOUNT + pow5_bits(q) - 1;
+        i32 i = -e2 + q + k;
+        vr = mul_shift(mv, float_pow5_inv_split[q], i);
+        vp = mul_shift(mp, float_pow5_inv_split[q], i);
+        vm = mul_shift(mm, float_pow5_inv_split[q], i);
+
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            // The digit loop below may stop before removing anything, so find the
+            // digit just past the current precision now.
+            i32 l = FLOAT_POW5_INV_BITCOUNT + pow5_bits(q - 1) - 1;
+            last_removed_digit = mul_shift(mv, float_pow5_inv_split[q - 1], -e2 + q - 1 + l) % 10;
+        }
+
+        if (q <= 9) {
+            // Only one of mp, mv and mm can be a multiple of 5, if any.
+            if (mv % 5 == 0)
+                vr_trailing_zeros = multiple_of_pow5(mv, q);
+            else if (accept_bounds)
+                vm_trailing_zeros = multiple_of_pow5(mm, q);
+            else
+                vp -= multiple_of_pow5(mp, q);
+        }
+    } else {
+        u32 q = log10_pow5(-e2);
+        e10 = (i32) q + e2;
+        i32 i = -e2 - q;
+        i32 k = pow5_bits(i) - FLOAT_POW5_BITCOUNT;
+        i32 j = (i32) q - k;
+        vr = mul_shift(mv, float_pow5_split[i], j);
+        vp = mul_shift(mp, float_pow5_split[i], j);
+        vm = mul_shift(mm, float_pow5_split[i], j);
+
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            j = (i32) q - 1 - (pow5_bits(i + 1) - FLOAT_POW5_BITCOUNT);
+            last_removed_digit = mul_shift(mv, float_pow5_split[i + 1], j) % 10;
+        }
+
+        if (q <= 1) {
+            // mv has at least q trailing zero bits, so vr is exact.
+            vr_trailing_zeros = true;
+            if (accept_bounds)
+                vm_trailing_zeros = mm_shift == 1;
+            else
+                vp--;
+        } else if (q < 31) {
+            vr_trailing_zeros = multiple_of_pow2(mv, q - 1);
+        }
+    }
+
+    i32 removed = 0;
+    u32 output;
+
+    if (vm_trailing_zeros || vr_trailing_zeros) {
+        // Rare: an end of the interval is exact, so ties need careful handling.
+        while (vp / 10 > vm / 10) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed_digit == 0;
+            last_removed_digit = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+
+        if (vm_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed_digit == 0;
+                last_removed_digit = vr % 10;
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+
+        // Exactly halfway: round to even.
+        if (vr_trailing_zeros && last_removed_digit == 5 && vr % 2 == 0)
+            last_removed_digit = 4;
+
+        output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed_digit >= 5);
+    } else {
+        while (vp / 10 > vm / 10) {
+            last_removed_digit = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || last_removed_digit >= 5);
+    }
+
+    *digits = output;
+    *exponent = e10 + removed;
+}
+
+u32 format_float(char* dest, f32 value)
+{
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    bool negative = (bits >> 31) != 0;
+    u32 ieee_mantissa = bits & ((1u << FLOAT_MANTISSA_BITS) - 1);
+    u32 ieee_exponent = (bits >> FLOAT_MANTISSA_BITS) & 0xff;
+
+    char* pos = dest;
+
+    if (ieee_exponent == 0xff) {
+        if (ieee_mantissa != 0) {
+            memcpy(pos, "nan", 3);
+            return 3;
+        }
+        if (negative)
+            *pos++ = '-';
+        memcpy(pos, "inf", 3);
+        return pos + 3 - dest;
+    }
+
+    if (negative)
+        *pos++ = '-';
+
+    if (ieee_exponent == 0 && ieee_mantissa == 0) {
+        memcpy(pos, "0.0", 3);
+        return pos + 3 - dest;
+    }
+
+    u32 digits;
+    i32 exponent;
+    shortest_decimal(ieee_mantissa, ieee_exponent, &digits, &exponent);
+
+    i32 length = decimal_length(digits);
+
+    // Decimal exponent of the leading digit.
+    i32 leading = exponent + length - 1;
+
+    if (leading < -5 || leading >= 9) {
+        // Scientific notation: d.ddde-N
+        write_digits(pos + 1, digits, length);
+        pos[0] = pos[1];
+        if (length > 1) {
+            pos[1] = '.';
+            pos += length + 1;
+        } else {
+            pos += 1;
+        }
+
+        *pos++ = 'e';
+        if (leading < 0) {
+            *pos++ = '-';
+            leading = -leading;
+        }
+        pos += format_int(pos, leading);
+        return pos - dest;
+    }
+
+    if (exponent >= 0) {
+        // Whole number: digits, trailing zeros, then ".0" so it still reads as a float.
+        write_digits(pos, digits, length);
+        pos += length;
+        memset(pos, '0', exponent);
+        pos += exponent;
+        memcpy(pos, ".0", 2);
+        return pos + 2 - dest;
+    }
+
+    if (leading >= 0) {
+        // Point inside the digits.
+        u32 whole = leading + 1;
+        write_digits(pos + 1, digits, length);
+        memmove(pos, pos + 1, whole);
+        pos[whole] = '.';
+        return pos + length + 1 - dest;
+    }
+
+    // Leading zeros after the point.
+    u32 zeros = -leading - 1;
+    memcpy(pos, "0.", 2);
+    pos += 2;
+    memset(pos, '0', zeros);
+    pos += zeros;
+    write_digits(pos, digits, length);
+    return pos + length - dest;
+}
@@ -0,0 +1,14 @@
+// Copyright (c) Andrew Fischer. See LICENSE file for license terms.
+
+#pragma once
+
+// Largest number of characters written by format_int and format_float.
+#define FORMAT_INT_MAX 20
+#define FORMAT_FLOAT_MAX 16
+
+// Write the decimal form of a number to 'dest' (not null terminated) and return the
+// number of characters written.
+u32 format_int(char* dest, i64 value);
+
+// Floats are written with the fewest digits that still parse back to the same value.
+u32 format_float(char* dest, f32 value);
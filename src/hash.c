@@ -0,0 +1,229 @@
+
+#include "ice_internal_headers.h"
+
+#include <pthread.h>
+
+#include "block.h"
+#include "hash.h"
+#include "value.h"
+
+// Blobs and lists are hashed with a polynomial over their elements, modulo the
+// Mersenne prime 2^61-1:
+//
+//     state = e[0]*B^(n-1) + e[1]*B^(n-2) + ... + e[n-1]
+//
+// An element is a byte for blobs, and the hashcode of an item for lists. The state is
+// order-sensitive, and it composes: a Node's state is state(left) * B^len(right) +
+// state(right). So a Node can combine the cached states of its children, and Flat,
+// Slice and Node representations of the same content always hash the same.
+//
+// The state is finished with a wyhash-style multiply-mix, together with the length
+// and logical type. Non-object values are mixed directly from their raw bits.
+
+#ifndef ICE_HASH_SEED
+  #define ICE_HASH_SEED 0x2d358dccaa6c78a5ull
+#endif
+
+#define P61 ((1ull << 61) - 1)
+#define SECRET_1 0x8bb84b93962eacc9ull
+#define SECRET_2 0x4b33a62ed433d4a3ull
+
+typedef unsigned __int128 u128;
+
+// B^0..B^8 for the unrolled byte loop, and B^(2^i) for building larger powers. They
+// depend on ICE_HASH_SEED, and are computed once, on first use from any thread.
+static u64 hash_base_powers[9];
+static u64 hash_base_squares[17];
+static pthread_once_t hash_tables_once = PTHREAD_ONCE_INIT;
+
+static u64 mix(u64 a, u64 b)
+{
+    u128 r = (u128) a * b;
+    return (u64) r ^ (u64) (r >> 64);
+}
+
+static u64 reduce(u128 x)
+{
+    // Valid for x < 2^124.
+    u64 r = ((u64) x & P61) + (u64) (x >> 61);
+    r = (r & P61) + (r >> 61);
+    return r >= P61 ? r - P61 : r;
+}
+
+static u64 mulmod(u64 a, u64 b)
+{
+    return reduce((u128) a * b);
+}
+
+static void compute_hash_tables()
+{
+    // Keep the base well away from small values.
+    u64 base = (mix(ICE_HASH_SEED ^ SECRET_1, SECRET_2) % (P61 - (1ull << 32))) + (1ull << 32);
+
+    hash_base_powers[0] = 1;
+    for (int i=1; i < 9; i++)
+        hash_base_powers[i] = mulmod(hash_base_powers[i - 1], base);
+
+    hash_base_squares[0] = base;
+    for (int i=1; i < 17; i++)
+        hash_base_squares[i] = mulmod(hash_base_squares[i - 1], hash_base_squares[i - 1]);
+}
+
+static void hash_init()
+{
+    pthread_once(&hash_tables_once, compute_hash_tables);
+}
+
+static u64 base_pow(u32 n)
+{
+    if (n <= 8)
+        return hash_base_powers[n];
+
+    u64 result = 1;
+    for (int i=0; n != 0; i++, n >>= 1)
+        if (n & 1)
+            result = mulmod(result, hash_base_squares[i]);
+    return result;
+}
+
+static u64 hash_state_bytes(u64 state, const u8* data, u32 size)
+{
+    const u64* pow = hash_base_powers;
+
+    // Eight bytes per reduction. Each term is under 2^69, so the sum fits easily.
+    while (size >= 8) {
+        u128 sum = (u128) state * pow[8]
+            + (u128) data[0] * pow[7] + (u128) data[1] * pow[6]
+            + (u128) data[2] * pow[5] + (u128) data[3] * pow[4]
+            + (u128) data[4] * pow[3] + (u128) data[5] * pow[2]
+            + (u128) data[6] * pow[1] + data[7];
+        state = reduce(sum);
+        data += 8;
+        size -= 8;
+    }
+
+    for (u32 i=0; i < size; i++)
+        state = reduce((u128) state * pow[1] + data[i]);
+
+    return state;
+}
+
+static u64 hash_state_values(u64 state, const Value* values, u32 count)
+{
+    for (u32 i=0; i < count; i++)
+        state = reduce((u128) state * hash_base_powers[1] + hashcode(values[i]));
+    return state;
+}
+
+// Tables hash the same whatever order their pairs are in, so each pair is mixed on its
+// own and the results are summed.
+static u64 hash_state_pairs(u64 state, const Value* pairs, u32 count)
+{
+    for (u32 i=0; i < count; i++) {
+        u64 pair = ((u64) hashcode(pairs[i * 2]) << 32) | hashcode(pairs[i * 2 + 1]);
+        state = reduce((u128) state + (mix(pair ^ SECRET_1, SECRET_2) >> 3));
+    }
+    return state;
+}
+
+static bool is_list_like(u8 logical_type)
+{
+    return logical_type == LIST_TYPE || logical_type == TABLE_TYPE;
+}
+
+// Number of polynomial elements in an object.
+static u32 hash_length(Value val)
+{
+    if (is_list_like(val.object->logical_type))
+        return block_size(val) / sizeof(Value);
+    return block_size(val);
+}
+
+static u64 hash_state(Value val)
+{
+    if (val.object->hash != 0)
+        return val.object->hash - 1;
+
+    u64 state = 0;
+
+    if (is_node_block(val)) {
+        Value right = val.node->right;
+        u64 left_state = is_object(val.node->left) ? hash_state(val.node->left) : 0;
+        u64 right_state = is_object(right) ? hash_state(right) : 0;
+        u32 right_length = is_object(right) ? hash_length(right) : 0;
+        state = reduce((u128) left_state * base_pow(right_length) + right_state);
+    } else if (val.object->logical_type == TABLE_TYPE) {
+        for_each_section(val, it) {
+            u32 size;
+            u8* section = iterator_get_section(&it, &size);
+            state = hash_state_pairs(state, (Value*) section, size / (sizeof(Value) * 2));
+        }
+    } else if (is_list_like(val.object->logical_type)) {
+        for_each_section(val, it) {
+            u32 size;
+            u8* section = iterator_get_section(&it, &size);
+            state = hash_state_values(state, (Value*) section, size / sizeof(Value));
+        }
+    } else {
+        for_each_section(val, it) {
+            u32 size;
+            u8* section = iterator_get_section(&it, &size);
+            state = hash_state_bytes(state, section, size);
+        }
+    }
+
+    val.object->hash = state + 1;
+    return state;
+}
+
+static u64 hash_finish64(u64 state, u32 length, u8 logical_type)
+{
+    return mix(state ^ ICE_HASH_SEED ^ SECRET_1, (((u64) length << 8) | logical_type) ^ SECRET_2);
+}
+
+static u32 hash_finish(u64 state, u32 length, u8 logical_type)
+{
+    u64 h = hash_finish64(state, length, logical_type);
+    u32 result = (u32) (h ^ (h >> 32));
+
+    // Don't allow a hashcode of 0, since 0 has special meaning of "not computed".
+    result += (result == 0) * 1;
+    return result;
+}
+
+u32 hashcode_bytes(u8 logical_type, const u8* data, u32 size)
+{
+    hash_init();
+    return hash_finish(hash_state_bytes(0, data, size), size, logical_type);
+}
+
+u32 hashcode(Value val)
+{
+    hash_init();
+
+    if (is_object(val))
+        return hash_finish(hash_state(val), hash_length(val), val.object->logical_type);
+
+    // Empty values hash the same as a zero-sized object of the same type.
+    if (is_empty_list(val))
+        return hash_finish(0, 0, LIST_TYPE);
+    if (is_empty_table(val))
+        return hash_finish(0, 0, TABLE_TYPE);
+    if (is_empty_blob(val))
+        return hash_finish(0, 0, BLOB_TYPE);
+
+    u64 h = mix(val.raw ^ ICE_HASH_SEED ^ SECRET_2, SECRET_1);
+    u32 result = (u32) (h ^ (h >> 32));
+    result += (result == 0) * 1;
+    return result;
+}
+
+u64 hashcode64(Value val)
+{
+    hash_init();
+
+    if (is_object(val))
+        return hash_finish64(hash_state(val), hash_length(val), val.object->logical_type);
+
+    return ((u64) hashcode(val) << 32) | hashcode(val);
+}
@@ -0,0 +1,11 @@
+
+#pragma once
+
+// Same result as hashcode() on a flat of 'logical_type' holding these bytes.
+u32 hashcode_bytes(u8 logical_type, const u8* data, u32 size);
+
+// The full 64 bits that hashcode() folds down to 32, for when a match has to be
+// trusted without comparing contents (see write_file_if_different). The underlying
+// polynomial state is 61 bits, so two values of the same length collide with
+// probability around length / 2^61.
+u64 hashcode64(Value val);
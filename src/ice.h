@@ -23,6 +23,8 @@ typedef double f64;
 typedef struct Flat Flat;
 typedef struct Slice Slice;
 typedef struct Node Node;
+typedef struct Mapped Mapped;
+typedef struct External External;
 typedef struct Value Value;
 typedef struct ObjectHeader ObjectHeader;
 
@@ -30,6 +32,8 @@ typedef struct ObjectHeader ObjectHeader;
 #define FLAT_BLOCK  1
 #define SLICE_BLOCK 2
 #define NODE_BLOCK  3
+#define MAPPED_BLOCK 4
+#define EXTERNAL_BLOCK 5
 
 // Logical type
 #define LIST_TYPE   1
@@ -42,6 +46,8 @@ typedef struct ObjectHeader ObjectHeader;
 // Data layout enum
 #define TABLE_LAYOUT_UNINDEXED_LIST 1
 #define TABLE_LAYOUT_INDEXED_LIST 2
+#define TEXT_LAYOUT_ASCII 1
+#define TEXT_LAYOUT_INDEXED 2
 
 #define TAG_OBJECT             0x0
 #define TAG_OPAQUE_POINTER     0x1
@@ -67,6 +73,8 @@ typedef struct PACKED Value {
         Flat* flat;
         Slice* slice;
         Node* node;
+        Mapped* mapped;
+        External* external;
 
         // Small blob
         struct {
@@ -113,10 +121,16 @@ typedef struct PACKED Value {
 typedef struct PACKED ObjectHeader {
     u8 block_type: 3;
     u8 logical_type: 3;
-    u8 padding: 2;
+
+    // Set if this block is the single shared copy of its content (see intern.c).
+    u8 interned: 1;
+    u8 padding: 1;
     u8 refcount;
     u8 layout;
     u16 size;
+
+    // Cached hash state (see hash.c) plus one, or 0 if not computed yet.
+    u64 hash;
 } ObjectHeader;
 
 typedef struct PACKED Flat {
@@ -134,8 +148,31 @@ typedef struct PACKED Node {
     ObjectHeader header;
     Value left;
     Value right;
+
+    // Number of code points, for text nodes (see text.c).
+    u16 char_count;
 } Node;
 
+// A leaf block whose bytes are a read-only mmap of a file. The region is unmapped
+// when the block is freed.
+typedef struct PACKED Mapped {
+    ObjectHeader header;
+    u8* data;
+    void* region;
+    u64 region_size;
+} Mapped;
+
+typedef void (*external_free_func)(void* ptr, void* context);
+
+// A leaf block whose bytes are owned by someone else. 'free_func' (if not NULL) is
+// called with the data pointer and 'context' when the block is freed.
+typedef struct PACKED External {
+    ObjectHeader header;
+    u8* data;
+    external_free_func free_func;
+    void* context;
+} External;
+
 typedef Value (*func_1)(Value arg1);
 typedef Value (*func_2)(Value arg1, Value arg2);
 typedef void (*void_func_1)(Value arg1);
@@ -169,6 +206,10 @@ Value deep_replace(Value value /*consumed*/, Value target, Value replacement);
 
 void print(Value value);
 void println(Value value);
+
+// Write the same text as stringify() to a file descriptor, through a bounded buffer.
+// Returns false if a write failed.
+bool write_value(int fd, Value value);
 void print_raw(Value value);
 void dump(Value value);
 
@@ -179,6 +220,11 @@ u32 hashcode(Value val);
 
 // Order comparison using default sorting. Returns -1 if 'left' should occur first, 1 if
 // 'right' should occur first, and 0 if they have equal order.
+//
+// This is a total order, and only equal values have equal order. Values sort first by
+// type (nil, bools, ints, floats, blobs, texts, symbols, lists, tables), then by
+// content: numbers numerically, blobs, texts and symbols by their bytes, lists item by
+// item.
 int compare(Value left, Value right);
 
 // A 'leaf' value does not contain or reference any other values.
@@ -246,6 +292,7 @@ bool list_equals(Value left, Value right);
 Value prepend(Value list /*consumed*/, Value prefix /*consumed*/);
 Value append(Value list /*consumed*/, Value suffix /*consumed*/);
 Value concat_n(Value items /*consumed*/);
+// Concatenating a blob onto text checks that it's valid UTF-8, and returns nil if not.
 Value concat(Value left /*consumed*/, Value right /*consumed*/);
 //Value slice(Value list /* consumed */, int start_index, int length);
 Value first(Value list /* consumed */);
@@ -260,6 +307,21 @@ void each_1(Value list /*consumed*/, void_func_2 func /* consumes arg2 */, Value
 Value filter(Value list /*consumed*/, func_1 func /* arg1 readonly */);
 Value filter_1(Value list /*consumed*/, func_2 func /* arg1 readonly */, Value arg1);
 
+// Stable sort using compare(). Returns a flat list. Long lists of numbers, blobs and
+// symbols are sorted on several threads.
+Value sort(Value list /*consumed*/);
+
+// Stable sort where 'by' returns an int: negative if arg1 should occur first, positive
+// if arg2 should, and 0 to keep their existing order.
+Value sort_by(Value list /*consumed*/, func_2 by /* args readonly */);
+
+// The first 'k' items that sort(), or sort_by() with 'by', would return, without
+// sorting the whole list. Pass NULL as 'by' to use compare().
+Value top_k(Value list /*consumed*/, int k, func_2 by /* args readonly */);
+
+// The item at 'index' in the sorted list, found by selection. Nil if out of range.
+Value nth_sorted(Value list /*consumed*/, int index, func_2 by /* args readonly */);
+
 Value list_iterator_start(Value list);
 bool list_iterator_valid(Value it);
 Value list_iterator_advance(Value it /*consumed*/);
@@ -267,6 +329,9 @@ Value list_iterator_current(Value it);
 Value list_iterator_take(Value it);
 
 // Table
+//
+// A table holds at most 4095 pairs, since a block is at most 0xffff bytes. Building
+// or inserting past that returns nil (the arguments are still consumed).
 Value table0();
 Value table1(Value k /*consumed*/, Value v /*consumed*/);
 Value table2(Value k1 /*consumed*/, Value v1 /*consumed*/,
@@ -284,6 +349,11 @@ Value table5(Value k1 /*consumed*/, Value v1 /*consumed*/,
     Value k4 /*consumed*/, Value v4 /*consumed*/,
     Value k5 /*consumed*/, Value v5 /*consumed*/);
 
+// Build a table in one pass from a list of [key, value] pairs. Duplicate keys keep
+// their first position and take the last value.
+Value table_from_pairs(Value pairs /*consumed*/);
+Value table_from_arrays(Value* keys /*consumed*/, Value* vals /*consumed*/, int count);
+
 Value get(Value table, Value key);
 Value get2(Value table, Value key1, Value key2);
 Value set(Value table /*consumed*/, Value key /*consumed*/, Value val /*consumed*/);
@@ -300,14 +370,89 @@ Value from_str(const char* source);
 Value to_cstr(Value blob /*modified*/);
 char* as_cstr(Value blob);
 
+// Wrap memory owned by another library as a blob, without copying. Ownership passes
+// to the blob: 'free_func' is called once no value refers to the memory. The memory
+// must not change while the blob is alive.
+//
+// If 'size' is over MAX_BLOB_SIZE (0xffff), returns nil and doesn't take ownership, so
+// the caller still has to free the memory.
+Value blob_from_external(u8* data, u32 size, external_free_func free_func, void* context);
+
+// Strings
+//
+// Results are slices of the input where possible, so no bytes are copied.
+
+// Split on every occurrence of 'sep'. Empty pieces between adjacent separators are kept.
+// Text is only split on code point boundaries. Returns nil if there are more pieces than
+// fit in one list.
+Value string_split(Value str /*consumed*/, Value sep /*consumed*/);
+
+// Concatenate the blobs in 'list' with 'sep' between each. The result is a balanced
+// tree that shares the items. Returns nil if the result is too large for one blob.
+Value string_join(Value list /*consumed*/, Value sep /*consumed*/);
+
+// Remove leading and trailing whitespace.
+Value string_trim(Value str /*consumed*/);
+
+// ASCII case mapping. Other bytes are left as they are.
+Value string_upper(Value str /*consumed*/);
+Value string_lower(Value str /*consumed*/);
+
+// Replace every 'from' byte with 'to'. Text is checked again if either byte isn't
+// ASCII, and the result is nil if it's no longer valid UTF-8.
+Value string_replace_byte(Value str /*consumed*/, u8 from, u8 to);
+
+bool is_ascii(Value str);
+
+// Offset of the first match of 'needle' at or after 'start', or -1. Matches may span
+// sections of a rope. The result can be passed to byte_slice.
+int find(Value blob, Value needle, u32 start);
+
+// Offset of the first byte at or after 'start' that appears in 'byte_set', or -1.
+int find_any(Value blob, Value byte_set, u32 start);
+
+bool contains(Value blob, Value needle);
+
+// Text
+//
+// Text is a blob that holds valid UTF-8, and is indexed by code point.
+
+// Validate 'blob' as UTF-8 and return it as text, or nil if it isn't valid.
+Value text_from_blob(Value blob /*consumed*/);
+Value text_from_str(const char* str);
+bool is_text(Value value);
+
+// Number of code points.
+u32 char_length(Value text);
+
+// The code point at 'index', or -1 if out of range.
+int char_at(Value text, u32 index);
+
+// Code points [start, start + count), as a slice of 'text'.
+Value text_slice(Value text /*consumed*/, u32 start, u32 count);
+
 // Symbol
 Value symbol(const char* str);
 Value gensym(Value value /*consumed*/);
 
+// Hash-consing
+//
+// Returns a shared block equal to 'value', so that equal values interned this way are
+// shallow_equals. Items of lists and tables are interned too. Interned blocks are
+// freed as usual once nothing references them.
+Value intern_value(Value value /*consumed*/);
+
 // Primitives
+
+// Parse the number at the start of 'blob'. Integers saturate when out of range, and
+// floats are correctly rounded.
 i64 ice_atoi(Value blob);
 f64 ice_atof(Value blob);
 
+// Parse every blob in 'list' as an int. Items that aren't entirely an integer in
+// range become nil.
+Value parse_ints(Value list /*consumed*/);
+
 // Lisp
 Value parse(Value blob /*consumed*/);
 Value parse_s(const char* str);
@@ -318,8 +463,53 @@ Value eval(Value expr /*consumed*/);
 Value parse(Value text /* consumed */);
 
 // File i/o
+
+// Write a blob's sections with writev, without flattening. Returns false on error.
+bool write_blob(int fd, Value blob);
+
+// Read a whole file or file descriptor as a blob, or nil on error or if it's too large
+// for one blob. The result is a balanced rope of chunks, unless READ_SINGLE_FLAT is
+// given, in which case regular files are read into one allocation sized by fstat.
+//
+// With READ_MAPPED, a regular file is mapped instead of read, and nothing is copied
+// until the pages are touched. The blob reflects the file, so the file must not be
+// modified while the blob is alive.
+#define READ_SINGLE_FLAT 1
+#define READ_MAPPED 2
 Value read_file(Value filename /*consumed*/);
+Value read_file_with_flags(Value filename /*consumed*/, u32 flags);
+Value read_fd(int fd, u32 flags);
+
+// Read a list of files, returning a list of blobs in the same order (nil for files
+// that couldn't be read). Opens and reads are batched with io_uring where it's
+// available, otherwise spread over a pool of threads.
+Value read_files(Value paths /*consumed*/);
+
+// Write 'contents' to the file unless it already holds exactly those bytes. Returns
+// true if the file was written, false if it was already the same, and nil on error.
+// The new contents are written to a temporary file and renamed over the target.
+//
+// With WRITE_HASH_SIDECAR, a 64-bit hash of the contents is kept in '<filename>.hash'
+// along with the file's size, inode and mtime. When those still match, the file
+// isn't read at all. The check still costs a stat and a sidecar read per file.
+#define WRITE_HASH_SIDECAR 1
 Value write_file_if_different(Value filename /*consumed*/, Value contents);
+Value write_file_if_different_with_flags(Value filename /*consumed*/, Value contents, u32 flags);
+
+// Serialization
+
+// Encode a value and everything it references as one blob. Objects that are
+// referenced more than once are stored once, and load back as one shared object.
+// If the result doesn't fit in one blob, serialize returns nil; serialize_to_fd has
+// no such limit.
+Value serialize(Value value);
+bool serialize_to_fd(int fd, Value value);
+
+// Load serialized data, or nil if it's malformed. Loaded blobs aren't copied: they
+// are slices of 'data', or with load_serialized_file, views into the mapped file.
+// Opaque pointers are stored as is, so only load them in the process that wrote them.
+Value deserialize(Value data /*consumed*/);
+Value load_serialized_file(Value filename /*consumed*/);
 
 #ifdef __cplusplus
 } // extern "C"
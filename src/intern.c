@@ -0,0 +1,169 @@
+
+#include "ice_internal_headers.h"
+
+#include "block.h"
+#include "intern.h"
+#include "symbol.h"
+#include "value.h"
+
+bool is_interned(Value value)
+{
+    return is_object(value) && value.object->interned;
+}
+
+static bool bytes_match(Value value, u8 logical_type, const u8* data, u32 size)
+{
+    // Interned blobs are always flat.
+    return value.object->logical_type == logical_type
+        && value.object->size == size
+        && memcmp(value.flat->data, data, size) == 0;
+}
+
+Value intern_table_find(InternTable* table, Value key, u32 hash)
+{
+    if (table->capacity == 0)
+        return (Value) {.raw = 0};
+
+    u32 mask = table->capacity - 1;
+    for (u32 i = hash & mask; table->slots[i].raw != 0; i = (i + 1) & mask) {
+        Value slot = table->slots[i];
+        if (hashcode(slot) == hash && equals(slot, key))
+            return slot;
+    }
+
+    return (Value) {.raw = 0};
+}
+
+Value intern_table_find_bytes(InternTable* table, u8 logical_type, const u8* data, u32 size,
+    u32 hash)
+{
+    if (table->capacity == 0)
+        return (Value) {.raw = 0};
+
+    u32 mask = table->capacity - 1;
+    for (u32 i = hash & mask; table->slots[i].raw != 0; i = (i + 1) & mask) {
+        Value slot = table->slots[i];
+        if (hashcode(slot) == hash && bytes_match(slot, logical_type, data, size))
+            return slot;
+    }
+
+    return (Value) {.raw = 0};
+}
+
+static void insert_slot(Value* slots, u32 capacity, Value value)
+{
+    u32 mask = capacity - 1;
+    u32 i = hashcode(value) & mask;
+    while (slots[i].raw != 0)
+        i = (i + 1) & mask;
+    slots[i] = value;
+}
+
+static void grow(InternTable* table)
+{
+    u32 capacity = table->capacity == 0 ? 64 : table->capacity * 2;
+    Value* slots = malloc(sizeof(Value) * capacity);
+    memset(slots, 0, sizeof(Value) * capacity);
+
+    // Members have cached hashcodes, so this doesn't rehash any content.
+    for (u32 i=0; i < table->capacity; i++)
+        if (table->slots[i].raw != 0)
+            insert_slot(slots, capacity, table->slots[i]);
+
+    if (table->slots != NULL)
+        free(table->slots);
+
+    table->slots = slots;
+    table->capacity = capacity;
+}
+
+void intern_table_insert(InternTable* table, Value value)
+{
+    assert(is_object(value));
+
+    // Keep the load factor at or under 50%.
+    if ((table->count + 1) * 2 > table->capacity)
+        grow(table);
+
+    value.object->interned = 1;
+    insert_slot(table->slots, table->capacity, value);
+    table->count++;
+}
+
+static void intern_table_remove(InternTable* table, Value value)
+{
+    u32 mask = table->capacity - 1;
+    u32 i = hashcode(value) & mask;
+    while (table->slots[i].raw != value.raw) {
+        assert(table->slots[i].raw != 0);
+        i = (i + 1) & mask;
+    }
+
+    // Shift later members of the probe chain back, so no lookup stops early at the
+    // hole. A member can fill the hole if its home slot isn't between the two.
+    u32 j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (table->slots[j].raw == 0)
+            break;
+
+        u32 home = hashcode(table->slots[j]) & mask;
+        bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays) {
+            table->slots[i] = table->slots[j];
+            i = j;
+        }
+    }
+
+    table->slots[i].raw = 0;
+    table->count--;
+}
+
+// Values that went through intern_value(). The table is weak: members remove
+// themselves when they are freed.
+InternTable g_values;
+
+void intern_release(Value value)
+{
+    // Symbols are permanent, so anything released here is in g_values.
+    intern_table_remove(&g_values, value);
+    value.object->interned = 0;
+}
+
+Value intern_value(Value value)
+{
+    if (!is_object(value) || is_interned(value))
+        return value;
+
+    if (is_symbol(value)) {
+        value = flatten(value);
+        Value result = symbol_from_bytes(value.flat->data, value.flat->header.size);
+        decref(value);
+        return result;
+    }
+
+    u32 hash = hashcode(value);
+    Value existing = intern_table_find(&g_values, value, hash);
+    if (existing.raw != 0) {
+        decref(value);
+        return incref(existing);
+    }
+
+    // First time we've seen this content. Keep one flat copy of it, with its items
+    // interned too. Items are swapped for equal values, so the hash doesn't change,
+    // and the cached one is put back.
+    u64 hash_state = value.object->hash;
+    value = writeable_flat(value);
+    value.object->hash = hash_state;
+
+    u8 logical_type = value.object->logical_type;
+    if (logical_type == LIST_TYPE || logical_type == TABLE_TYPE) {
+        Value* items = (Value*) value.flat->data;
+        u32 count = value.flat->header.size / sizeof(Value);
+        for (u32 i=0; i < count; i++)
+            items[i] = intern_value(items[i]);
+    }
+
+    intern_table_insert(&g_values, value);
+    return value;
+}
@@ -0,0 +1,21 @@
+
+#pragma once
+
+// A set of interned blocks, keyed by content. The set does not own a reference to
+// its members; the owner decides how long members live.
+
+typedef struct InternTable {
+    Value* slots; // slots[capacity], raw value of 0 means empty
+    u32 capacity;
+    u32 count;
+} InternTable;
+
+bool is_interned(Value value);
+
+// Called when an interned block is about to be freed.
+void intern_release(Value value);
+
+Value intern_table_find(InternTable* table, Value key, u32 hash);
+Value intern_table_find_bytes(InternTable* table, u8 logical_type, const u8* data, u32 size,
+    u32 hash);
+void intern_table_insert(InternTable* table, Value value);
@@ -66,8 +66,8 @@ void iterator_advance_val(Iterator* it)
 u8 iterator_get_u8(Iterator* it)
 {
     assert(!iterator_done(it));
-    assert(is_flat_block(it->object));
-    return it->object.flat->data[it->offset];
+    assert(is_leaf_block(it->object));
+    return leaf_data(it->object)[it->offset];
 }
 
 Value iterator_get_val(Iterator* it)
@@ -80,10 +80,10 @@ Value iterator_get_val(Iterator* it)
 u8* iterator_get_section(Iterator* it, u32* size)
 {
     assert(!iterator_done(it));
-    assert(is_flat_block(it->object));
+    assert(is_leaf_block(it->object));
 
     *size = it->end_pos - it->offset;
-    return it->object.flat->data + it->offset;
+    return leaf_data(it->object) + it->offset;
 }
 
 void iterator_advance_section(Iterator* it)
@@ -134,8 +134,9 @@ bool iterator_settle_one_step(Iterator* it)
     }
 
     switch (it->object.object->block_type) {
-    case FLAT_BLOCK: {
-        Flat* flat = it->object.flat;
+    case FLAT_BLOCK:
+    case MAPPED_BLOCK:
+    case EXTERNAL_BLOCK: {
 
         if (it->offset >= it->end_pos) {
             if (is_nil(it->stack)) {
@@ -32,7 +32,8 @@ void* ice_malloc(size_t size)
         internal_error("malloc failure");
 
     obj->allocation_header_sig = HEADER_SIGNATURE;
-    obj->friendly_id = g_next_friendly_id++;
+    // Atomic, so that worker threads can allocate new values.
+    obj->friendly_id = __atomic_fetch_add(&g_next_friendly_id, 1, __ATOMIC_RELAXED);
     obj->valid = true;
     return ((void*)obj) + sizeof(AllocationHeader);
 }
@@ -51,10 +52,11 @@ void* ice_realloc(void* data, size_t size)
         return NULL;
     }
     
+    obj = realloc(obj, sizeof(AllocationHeader) + size);
+
     if (obj == NULL)
         internal_error("realloc failure");
 
-    obj = realloc(obj, size);
     return ((void*) obj) + sizeof(AllocationHeader);
 }
 
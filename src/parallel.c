@@ -0,0 +1,68 @@
+
+#include "ice_internal_headers.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+#define MAX_PARALLEL_THREADS 64
+
+static int g_thread_count_override = 0;
+
+int parallel_thread_count()
+{
+    if (g_thread_count_override > 0)
+        return g_thread_count_override;
+
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count < 1)
+        return 1;
+    if (count > MAX_PARALLEL_THREADS)
+        return MAX_PARALLEL_THREADS;
+    return (int) count;
+}
+
+void parallel_set_thread_count(int count)
+{
+    assert(count >= 0 && count <= MAX_PARALLEL_THREADS);
+    g_thread_count_override = count;
+}
+
+typedef struct ParallelCall {
+    parallel_func func;
+    void* arg;
+} ParallelCall;
+
+static void* parallel_thread_main(void* arg)
+{
+    ParallelCall* call = (ParallelCall*) arg;
+    call->func(call->arg);
+    return NULL;
+}
+
+void parallel_run(parallel_func func, void** args, int count)
+{
+    assert(count <= MAX_PARALLEL_THREADS);
+
+    pthread_t threads[MAX_PARALLEL_THREADS];
+    ParallelCall calls[MAX_PARALLEL_THREADS];
+    bool started[MAX_PARALLEL_THREADS];
+
+    for (int i=1; i < count; i++) {
+        calls[i].func = func;
+        calls[i].arg = args[i];
+        started[i] = pthread_create(&threads[i], NULL, parallel_thread_main, &calls[i]) == 0;
+
+        // Out of threads: do the work here instead.
+        if (!started[i])
+            func(args[i]);
+    }
+
+    if (count > 0)
+        func(args[0]);
+
+    for (int i=1; i < count; i++)
+        if (started[i])
+            pthread_join(threads[i], NULL);
+}
@@ -0,0 +1,16 @@
+
+#pragma once
+
+typedef void (*parallel_func)(void* arg);
+
+// Number of threads that parallel work should be split across. Defaults to the number
+// of online cores.
+int parallel_thread_count();
+
+// Override the thread count, or pass 0 to go back to the default.
+void parallel_set_thread_count(int count);
+
+// Call 'func' once for each of 'count' args, each on its own thread, and wait for all
+// of them to finish. The calling thread runs one of the calls itself. Workers may
+// create new values, but must not touch the refcounts of shared values.
+void parallel_run(parallel_func func, void** args, int count);
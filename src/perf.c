@@ -12,14 +12,15 @@ void perf_stats_reset()
     memset(&StatCount, 0, sizeof(StatCount));
 }
 
+// Parallel workers create values too, so the counts are updated atomically.
 void stat_inc_(StatEnum stat)
 {
-    StatCount[stat]++;
+    __atomic_fetch_add(&StatCount[stat], 1, __ATOMIC_RELAXED);
 }
 
 int perf_stat_get(StatEnum e)
 {
-    return StatCount[e];
+    return __atomic_load_n(&StatCount[e], __ATOMIC_RELAXED);
 }
 
 const char* perf_stat_to_string(StatEnum e)
@@ -33,6 +34,9 @@ const char* perf_stat_to_string(StatEnum e)
         CASE(incref);
         CASE(decref);
         CASE(get_index_recurse);
+        CASE(equals_section);
+        CASE(sort_radix);
+        CASE(sort_parallel);
 
         case num_stats:
             return "num_stats";
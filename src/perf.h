@@ -13,6 +13,9 @@ typedef enum StatEnum_ {
     stat_incref,
     stat_decref,
     stat_get_index_recurse,
+    stat_equals_section,
+    stat_sort_radix,
+    stat_sort_parallel,
 
     num_stats
 } StatEnum;
@@ -5,43 +5,320 @@
 
 #include "blob.h"
 #include "block.h"
+#include "list.h"
 #include "primitive.h"
 #include "value.h"
 
+// Numbers are parsed by streaming over the blob's sections, so ropes are never
+// flattened. Parsing stops at the first byte that can't continue the number.
+
+typedef struct IntScan {
+    u64 magnitude;
+    u32 digits;
+    u32 length; // bytes that were part of the number, including a sign
+    bool negative;
+    bool overflow;
+    bool done;
+} IntScan;
+
+static void int_scan_start(IntScan* scan)
+{
+    memset(scan, 0, sizeof(IntScan));
+}
+
+static void int_scan_section(IntScan* scan, const u8* data, u32 size)
+{
+    u32 i = 0;
+
+    if (scan->length == 0 && size > 0 && (data[0] == '-' || data[0] == '+')) {
+        scan->negative = data[0] == '-';
+        scan->length = 1;
+        i = 1;
+    }
+
+    for (; i < size; i++) {
+        u32 digit = data[i] - '0';
+        if (digit > 9) {
+            scan->done = true;
+            return;
+        }
+
+        if (scan->magnitude > (UINT64_MAX - digit) / 10)
+            scan->overflow = true;
+        else
+            scan->magnitude = scan->magnitude * 10 + digit;
+
+        scan->digits++;
+        scan->length++;
+    }
+}
+
+static void int_scan_blob(IntScan* scan, Value blob)
+{
+    for_each_section(blob, it) {
+        u32 size;
+        u8* section = iterator_get_section(&it, &size);
+        int_scan_section(scan, section, size);
+        if (scan->done) {
+            iterator_stop(&it);
+            break;
+        }
+    }
+}
+
+// Out of range values saturate.
+static i64 int_scan_result(IntScan* scan)
+{
+    if (scan->negative) {
+        if (scan->overflow || scan->magnitude >= (u64) INT64_MAX + 1)
+            return INT64_MIN;
+        return -(i64) scan->magnitude;
+    }
+
+    if (scan->overflow || scan->magnitude > (u64) INT64_MAX)
+        return INT64_MAX;
+    return (i64) scan->magnitude;
+}
+
 i64 ice_atoi(Value blob)
 {
-    blob = flatten(incref(blob));
+    IntScan scan;
+    int_scan_start(&scan);
+    int_scan_blob(&scan, blob);
+    return int_scan_result(&scan);
+}
+
+Value parse_ints(Value list)
+{
+    u32 count = length(list);
+    if (count == 0) {
+        decref(list);
+        return empty_list();
+    }
+
+    Flat* flat = new_flat(LIST_TYPE, sizeof(Value) * count);
+    Value* out = (Value*) flat->data;
+    IntScan scan;
+    u32 i = 0;
+
+    for_each_list_item(list, it) {
+        Value item = iterator_get_val(&it);
+        out[i] = nil_value();
 
-    int i = 0;
-    int result = 0;
-    bool sign = false;
-    u8* data = blob.flat->data;
-    int size = blob.flat->header.size;
+        if (is_blob(item)) {
+            int_scan_start(&scan);
+            int_scan_blob(&scan, item);
+            i64 result = int_scan_result(&scan);
 
-    if (data[0] == '-') {
-        sign = true;
+            if (scan.digits > 0 && scan.length == block_size(item)
+                    && result >= INT32_MIN && result <= INT32_MAX)
+                out[i] = int_value((i32) result);
+        }
         i++;
     }
 
-    for (; i < size; i++) {
-        result *= 10;
-        char c = data[i];
-        if ((c < '0') || (c > '9'))
+    decref(list);
+    return ptr_value(flat);
+}
+
+// Floats keep the first 19 significant digits as an integer mantissa, with a decimal
+// exponent. Most inputs then convert exactly with one floating point operation
+// (Clinger's fast path). Anything else, such as long mantissas or large exponents, goes
+// to strtod, which rounds correctly.
+
+#define MAX_MANTISSA_DIGITS 19
+#define MAX_EXPONENT 100000
+
+enum FloatScanState {
+    FLOAT_START,
+    FLOAT_INTEGER,
+    FLOAT_FRACTION,
+    FLOAT_EXPONENT_START,
+    FLOAT_EXPONENT_SIGN,
+    FLOAT_EXPONENT_DIGITS,
+    FLOAT_DONE
+};
+
+typedef struct FloatScan {
+    u64 mantissa;
+    u32 mantissa_digits;
+    int exponent;
+    int explicit_exponent;
+    bool negative;
+    bool exponent_negative;
+    bool any_digits;
+    bool truncated;
+    u8 state;
+    u32 length;
+    u32 accepted_length; // length of the longest prefix that is a complete number
+} FloatScan;
+
+static const f64 exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static void float_scan_digit(FloatScan* scan, u32 digit, bool fraction)
+{
+    scan->any_digits = true;
+
+    if (scan->mantissa_digits == 0 && digit == 0) {
+        // Leading zeros only move the exponent.
+        if (fraction)
+            scan->exponent--;
+        return;
+    }
+
+    if (scan->mantissa_digits < MAX_MANTISSA_DIGITS) {
+        scan->mantissa = scan->mantissa * 10 + digit;
+        scan->mantissa_digits++;
+        if (fraction)
+            scan->exponent--;
+    } else {
+        if (digit != 0)
+            scan->truncated = true;
+        if (!fraction)
+            scan->exponent++;
+    }
+}
+
+static void float_scan_section(FloatScan* scan, const u8* data, u32 size)
+{
+    for (u32 i=0; i < size && scan->state != FLOAT_DONE; i++) {
+        u8 c = data[i];
+        u32 digit = c - '0';
+        bool is_digit = digit <= 9;
+
+        switch (scan->state) {
+        case FLOAT_START:
+            scan->state = FLOAT_INTEGER;
+            if (c == '-' || c == '+') {
+                scan->negative = c == '-';
+                break;
+            }
+            // fall through
+        case FLOAT_INTEGER:
+        case FLOAT_FRACTION:
+            if (is_digit) {
+                float_scan_digit(scan, digit, scan->state == FLOAT_FRACTION);
+                scan->accepted_length = scan->length + 1;
+            } else if (c == '.' && scan->state == FLOAT_INTEGER) {
+                scan->state = FLOAT_FRACTION;
+            } else if ((c == 'e' || c == 'E') && scan->any_digits) {
+                scan->state = FLOAT_EXPONENT_START;
+            } else {
+                scan->state = FLOAT_DONE;
+            }
+            break;
+        case FLOAT_EXPONENT_START:
+            if (c == '-' || c == '+') {
+                scan->exponent_negative = c == '-';
+                scan->state = FLOAT_EXPONENT_SIGN;
+                break;
+            }
+            // fall through
+        case FLOAT_EXPONENT_SIGN:
+        case FLOAT_EXPONENT_DIGITS:
+            if (is_digit) {
+                scan->state = FLOAT_EXPONENT_DIGITS;
+                if (scan->explicit_exponent < MAX_EXPONENT)
+                    scan->explicit_exponent = scan->explicit_exponent * 10 + digit;
+                scan->accepted_length = scan->length + 1;
+            } else {
+                scan->state = FLOAT_DONE;
+            }
             break;
-        result += (c - '0');
+        }
+
+        if (scan->state != FLOAT_DONE)
+            scan->length++;
+    }
+}
+
+static bool float_fast_path(FloatScan* scan, f64* result)
+{
+    if (scan->truncated)
+        return false;
+
+    u64 mantissa = scan->mantissa;
+    int exponent = scan->exponent
+        + (scan->exponent_negative ? -scan->explicit_exponent : scan->explicit_exponent);
+
+    if (mantissa == 0) {
+        *result = 0.0;
+        return true;
     }
 
-    if (sign)
-        result *= -1;
+    // Both the mantissa and the power of ten must be exact doubles.
+    if (mantissa > (1ull << 53) || exponent < -22)
+        return false;
 
-    decref(blob);
+    if (exponent < 0) {
+        *result = (f64) mantissa / exact_powers_of_ten[-exponent];
+        return true;
+    }
+
+    // Move any excess exponent into the mantissa, while it stays exact.
+    for (; exponent > 22; exponent--) {
+        if (mantissa > (1ull << 53) / 10)
+            return false;
+        mantissa *= 10;
+    }
+
+    *result = (f64) mantissa * exact_powers_of_ten[exponent];
+    return true;
+}
+
+// Copy the number out and let strtod round it.
+static f64 float_slow_path(Value blob, u32 length)
+{
+    char stack_buffer[64];
+    char* buffer = length < sizeof(stack_buffer) ? stack_buffer : malloc(length + 1);
+
+    u32 offset = 0;
+    for_each_section(blob, it) {
+        u32 size;
+        u8* section = iterator_get_section(&it, &size);
+        u32 take = length - offset < size ? length - offset : size;
+        memcpy(buffer + offset, section, take);
+        offset += take;
+        if (offset == length) {
+            iterator_stop(&it);
+            break;
+        }
+    }
+    buffer[length] = 0;
+
+    f64 result = strtod(buffer, NULL);
+
+    if (buffer != stack_buffer)
+        free(buffer);
     return result;
 }
 
 f64 ice_atof(Value blob)
 {
-    // TODO
-    return ice_atoi(blob);
+    FloatScan scan;
+    memset(&scan, 0, sizeof(FloatScan));
+
+    for_each_section(blob, it) {
+        u32 size;
+        u8* section = iterator_get_section(&it, &size);
+        float_scan_section(&scan, section, size);
+        if (scan.state == FLOAT_DONE) {
+            iterator_stop(&it);
+            break;
+        }
+    }
+
+    if (!scan.any_digits)
+        return 0.0;
+
+    f64 result;
+    if (float_fast_path(&scan, &result))
+        return scan.negative ? -result : result;
+
+    return float_slow_path(blob, scan.accepted_length);
 }
 
 Value increment(Value i)
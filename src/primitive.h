@@ -4,6 +4,7 @@
 
 i64 ice_atoi(Value blob);
 f64 ice_atof(Value blob);
+Value parse_ints(Value list /*consumed*/);
 
 f32 to_float(Value v);
 
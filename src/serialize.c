@@ -0,0 +1,496 @@
+
+// For fstat() and mmap()
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ice_internal_headers.h"
+
+#include "blob.h"
+#include "block.h"
+#include "list.h"
+#include "symbol.h"
+#include "table.h"
+#include "value.h"
+
+// Binary format, version 1. All integers are in native (little-endian) byte order.
+//
+//     header:  "ICEV", u16 version, u16 reserved
+//     records: one per object, each starting on an 8-byte boundary:
+//                  u32 size, u8 logical_type, u8 layout, u16 reserved,
+//                  'size' bytes of data, zero padded to 8 bytes
+//     footer:  u64 root, u32 object_count, "VECI"
+//
+// Values are stored as their 8-byte tagged form. A reference to an object is stored
+// as the file offset of the object's record, which has TAG_OBJECT like a real
+// pointer. Records are written children first, so every reference points back to an
+// earlier record, and an object that's reachable more than once is written once.
+//
+// The data of a blob, text or symbol record is its bytes; the data of a list or table
+// is its items. So a loader can serve blobs straight out of the buffer.
+
+#define SERIALIZE_VERSION 1
+#define HEADER_MAGIC "ICEV"
+#define FOOTER_MAGIC "VECI"
+#define HEADER_SIZE 8
+#define FOOTER_SIZE 16
+#define RECORD_HEADER_SIZE 8
+
+typedef struct PACKED FileHeader {
+    u8 magic[4];
+    u16 version;
+    u16 reserved;
+} FileHeader;
+
+typedef struct PACKED RecordHeader {
+    u32 size;
+    u8 logical_type;
+    u8 layout;
+    u16 reserved;
+} RecordHeader;
+
+typedef struct PACKED Footer {
+    u64 root;
+    u32 object_count;
+    u8 magic[4];
+} Footer;
+
+static u8 value_tag(u64 raw)
+{
+    Value value;
+    value.raw = raw;
+    return value.tag;
+}
+
+// Object pointer -> record offset, open addressed.
+typedef struct WrittenMap {
+    u64* keys;
+    u64* offsets;
+    u32 capacity;
+    u32 count;
+} WrittenMap;
+
+static u32 pointer_slot(u64 key, u32 capacity)
+{
+    key *= 0x9e3779b97f4a7c15ull;
+    return (u32) (key >> 32) & (capacity - 1);
+}
+
+static void written_map_init(WrittenMap* map, u32 capacity)
+{
+    map->capacity = capacity;
+    map->count = 0;
+    map->keys = malloc(sizeof(u64) * capacity);
+    map->offsets = malloc(sizeof(u64) * capacity);
+    memset(map->keys, 0, sizeof(u64) * capacity);
+}
+
+static void written_map_free(WrittenMap* map)
+{
+    free(map->keys);
+    free(map->offsets);
+}
+
+static u64* written_map_find(WrittenMap* map, u64 key)
+{
+    u32 slot = pointer_slot(key, map->capacity);
+    while (map->keys[slot] != 0) {
+        if (map->keys[slot] == key)
+            return &map->offsets[slot];
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    return NULL;
+}
+
+static void written_map_insert(WrittenMap* map, u64 key, u64 offset)
+{
+    if ((map->count + 1) * 2 > map->capacity) {
+        WrittenMap larger;
+        written_map_init(&larger, map->capacity * 2);
+        for (u32 i=0; i < map->capacity; i++)
+            if (map->keys[i] != 0)
+                written_map_insert(&larger, map->keys[i], map->offsets[i]);
+        written_map_free(map);
+        *map = larger;
+    }
+
+    u32 slot = pointer_slot(key, map->capacity);
+    while (map->keys[slot] != 0)
+        slot = (slot + 1) & (map->capacity - 1);
+    map->keys[slot] = key;
+    map->offsets[slot] = offset;
+    map->count++;
+}
+
+typedef struct Writer {
+    BlobBuilder* builder;
+    u64 position;
+    u32 object_count;
+    WrittenMap written;
+} Writer;
+
+static void writer_put(Writer* writer, const void* data, u32 size)
+{
+    blob_builder_append(writer->builder, (const u8*) data, size);
+    writer->position += size;
+}
+
+static void writer_pad(Writer* writer)
+{
+    static const u8 zeros[8] = {0};
+    u32 padding = (8 - writer->position % 8) % 8;
+    writer_put(writer, zeros, padding);
+}
+
+static u64 encode_value(Writer* writer, Value value);
+
+static u64 write_record(Writer* writer, Value value)
+{
+    u8 logical_type = value.object->logical_type;
+    bool is_list_like = logical_type == LIST_TYPE || logical_type == TABLE_TYPE;
+
+    // Children go first, so their offsets are known.
+    u64* items = NULL;
+    u32 item_count = 0;
+    if (is_list_like) {
+        item_count = block_size(value) / sizeof(Value);
+        items = malloc(sizeof(u64) * item_count);
+        u32 i = 0;
+        for_each_list_item(value, it)
+            items[i++] = encode_value(writer, iterator_get_val(&it));
+    }
+
+    u64 offset = writer->position;
+    RecordHeader header;
+    header.size = block_size(value);
+    header.logical_type = logical_type;
+    header.layout = value.object->layout;
+    header.reserved = 0;
+    writer_put(writer, &header, sizeof(header));
+
+    if (is_list_like) {
+        writer_put(writer, items, sizeof(u64) * item_count);
+        free(items);
+    } else {
+        blob_builder_append_blob(writer->builder, value);
+        writer->position += block_size(value);
+    }
+
+    writer_pad(writer);
+    writer->object_count++;
+    return offset;
+}
+
+static u64 encode_value(Writer* writer, Value value)
+{
+    if (!is_object(value))
+        return value.raw;
+
+    u64* existing = written_map_find(&writer->written, (u64) value.ptr);
+    if (existing != NULL)
+        return *existing;
+
+    u64 offset = write_record(writer, value);
+    written_map_insert(&writer->written, (u64) value.ptr, offset);
+    return offset;
+}
+
+static void write_serialized(BlobBuilder* builder, Value value)
+{
+    Writer writer;
+    writer.builder = builder;
+    writer.position = 0;
+    writer.object_count = 0;
+    written_map_init(&writer.written, 64);
+
+    FileHeader header;
+    memcpy(header.magic, HEADER_MAGIC, 4);
+    header.version = SERIALIZE_VERSION;
+    header.reserved = 0;
+    writer_put(&writer, &header, sizeof(header));
+
+    Footer footer;
+    footer.root = encode_value(&writer, value);
+    footer.object_count = writer.object_count;
+    memcpy(footer.magic, FOOTER_MAGIC, 4);
+    writer_put(&writer, &footer, sizeof(footer));
+
+    written_map_free(&writer.written);
+}
+
+Value serialize(Value value)
+{
+    // Output that doesn't fit in one blob fails the builder, which finishes as nil.
+    BlobBuilder builder;
+    blob_builder_start(&builder, 256);
+    write_serialized(&builder, value);
+    return blob_builder_finish(&builder);
+}
+
+bool serialize_to_fd(int fd, Value value)
+{
+    BlobBuilder builder;
+    blob_builder_start_stream(&builder, fd, 8192);
+    write_serialized(&builder, value);
+    return blob_builder_finish_stream(&builder);
+}
+
+// A file mapping shared by every blob loaded from it. It's unmapped when the last
+// of them is freed.
+typedef struct MappedBacking {
+    void* region;
+    u64 size;
+    u32 refcount;
+} MappedBacking;
+
+static void backing_release(void* ptr, void* context)
+{
+    (void) ptr;
+    MappedBacking* backing = (MappedBacking*) context;
+    backing->refcount--;
+    if (backing->refcount == 0) {
+        munmap(backing->region, backing->size);
+        free(backing);
+    }
+}
+
+typedef struct Loader {
+    const u8* data;
+    u64 records_end;
+
+    // Where blobs come from: slices of 'source', or external blocks on 'backing'.
+    Value source;
+    MappedBacking* backing;
+
+    u64* offsets;
+    Value* loaded;
+    u32 count;
+    u32 capacity;
+} Loader;
+
+// Resolve a stored value. Object references must point to a record before 'before'.
+static bool decode_value(Loader* loader, u64 raw, u64 before, Value* out)
+{
+    u8 tag = value_tag(raw);
+
+    if (tag == TAG_OPAQUE_POINTER || tag == TAG_EX) {
+        out->raw = raw;
+        return true;
+    }
+
+    if (tag != TAG_OBJECT || raw >= before)
+        return false;
+
+    // Records were loaded in file order, so the offsets are sorted.
+    u32 low = 0;
+    u32 high = loader->count;
+    while (low < high) {
+        u32 mid = (low + high) / 2;
+        if (loader->offsets[mid] < raw)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (low == loader->count || loader->offsets[low] != raw)
+        return false;
+
+    *out = loader->loaded[low];
+    return true;
+}
+
+static Value load_bytes(Loader* loader, u8 logical_type, u64 offset, u32 size)
+{
+    const u8* bytes = loader->data + offset;
+
+    switch (logical_type) {
+    case BLOB_TYPE:
+        if (loader->backing != NULL) {
+            loader->backing->refcount++;
+            return blob_from_external((u8*) bytes, size, backing_release, loader->backing);
+        }
+        return byte_slice(incref(loader->source), offset, size);
+
+    case SYMBOL_TYPE:
+        return symbol_from_bytes(bytes, size);
+
+    case TEXT_TYPE: {
+        Flat* flat = new_flat(BLOB_TYPE, size);
+        memcpy(flat->data, bytes, size);
+        return text_from_blob(ptr_value(flat));
+    }
+    }
+
+    return nil_value();
+}
+
+static Value load_items(Loader* loader, u8 logical_type, u64 offset, u32 size)
+{
+    u32 count = size / sizeof(Value);
+    Value* items = malloc(sizeof(Value) * count);
+
+    for (u32 i=0; i < count; i++) {
+        u64 raw;
+        memcpy(&raw, loader->data + offset + i * sizeof(Value), sizeof(raw));
+        if (!decode_value(loader, raw, offset, &items[i])) {
+            free(items);
+            return nil_value();
+        }
+        incref(items[i]);
+    }
+
+    Value result;
+    if (logical_type == TABLE_TYPE) {
+        // The index isn't stored; building the table makes a new one.
+        u32 pair_count = count / 2;
+        Value* keys = malloc(sizeof(Value) * pair_count);
+        Value* vals = malloc(sizeof(Value) * pair_count);
+        for (u32 i=0; i < pair_count; i++) {
+            keys[i] = items[i * 2];
+            vals[i] = items[i * 2 + 1];
+        }
+        result = table_from_arrays(keys, vals, pair_count);
+        free(keys);
+        free(vals);
+    } else {
+        Flat* flat = new_flat(LIST_TYPE, size);
+        memcpy(flat->data, items, size);
+        result = ptr_value(flat);
+    }
+
+    free(items);
+    return result;
+}
+
+static Value load_records(Loader* loader, u64 data_size)
+{
+    if (data_size < HEADER_SIZE + FOOTER_SIZE)
+        return nil_value();
+    FileHeader header;
+    memcpy(&header, loader->data, sizeof(header));
+    if (memcmp(header.magic, HEADER_MAGIC, 4) != 0 || header.version != SERIALIZE_VERSION)
+        return nil_value();
+
+    Footer footer;
+    memcpy(&footer, loader->data + data_size - FOOTER_SIZE, FOOTER_SIZE);
+    if (memcmp(footer.magic, FOOTER_MAGIC, 4) != 0)
+        return nil_value();
+
+    loader->records_end = data_size - FOOTER_SIZE;
+    if (footer.object_count > loader->records_end / RECORD_HEADER_SIZE)
+        return nil_value();
+
+    loader->capacity = footer.object_count;
+    loader->count = 0;
+    loader->offsets = malloc(sizeof(u64) * (loader->capacity + 1));
+    loader->loaded = malloc(sizeof(Value) * (loader->capacity + 1));
+
+    bool ok = true;
+    u64 offset = HEADER_SIZE;
+
+    while (offset < loader->records_end) {
+        RecordHeader header;
+        if (loader->count == loader->capacity || offset + RECORD_HEADER_SIZE > loader->records_end) {
+            ok = false;
+            break;
+        }
+        memcpy(&header, loader->data + offset, RECORD_HEADER_SIZE);
+
+        u64 data_offset = offset + RECORD_HEADER_SIZE;
+        u8 type = header.logical_type;
+        bool is_list_like = type == LIST_TYPE || type == TABLE_TYPE;
+        if (header.size > MAX_BLOB_SIZE
+                || data_offset + header.size > loader->records_end
+                || (is_list_like && header.size % (type == TABLE_TYPE ? 16 : 8) != 0)) {
+            ok = false;
+            break;
+        }
+
+        Value value = is_list_like
+            ? load_items(loader, type, data_offset, header.size)
+            : load_bytes(loader, type, data_offset, header.size);
+
+        if (is_nil(value)) {
+            ok = false;
+            break;
+        }
+
+        loader->offsets[loader->count] = offset;
+        loader->loaded[loader->count] = value;
+        loader->count++;
+
+        offset = (data_offset + header.size + 7) & ~7ull;
+    }
+
+    Value root = nil_value();
+    if (ok && offset == loader->records_end && loader->count == footer.object_count
+            && decode_value(loader, footer.root, loader->records_end, &root))
+        incref(root);
+    else
+        root = nil_value();
+
+    for (u32 i=0; i < loader->count; i++)
+        decref(loader->loaded[i]);
+    free(loader->offsets);
+    free(loader->loaded);
+    return root;
+}
+
+Value deserialize(Value data /*consumed*/)
+{
+    if (!is_blob(data)) {
+        decref(data);
+        return nil_value();
+    }
+
+    // Loaded blobs are slices of the flattened input.
+    data = flatten(data);
+
+    Loader loader;
+    memset(&loader, 0, sizeof(loader));
+    loader.data = leaf_data(data);
+    loader.source = data;
+
+    Value result = load_records(&loader, block_size(data));
+    decref(data);
+    return result;
+}
+
+Value load_serialized_file(Value filename /*consumed*/)
+{
+    Value path = to_cstr(filename);
+    int fd = open((const char*) path.flat->data, O_RDONLY | O_CLOEXEC);
+    decref(path);
+    if (fd < 0)
+        return nil_value();
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return nil_value();
+    }
+
+    void* region = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED)
+        return nil_value();
+
+    // The loader holds one reference on the mapping while it runs, and each loaded
+    // blob holds another.
+    MappedBacking* backing = malloc(sizeof(MappedBacking));
+    backing->region = region;
+    backing->size = info.st_size;
+    backing->refcount = 1;
+
+    Loader loader;
+    memset(&loader, 0, sizeof(loader));
+    loader.data = (const u8*) region;
+    loader.backing = backing;
+
+    Value result = load_records(&loader, info.st_size);
+    backing_release(NULL, backing);
+    return result;
+}
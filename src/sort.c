@@ -0,0 +1,510 @@
+
+#include "ice_internal_headers.h"
+
+#include "block.h"
+#include "parallel.h"
+#include "sort.h"
+#include "value.h"
+
+#define min(x,y) ((x) < (y) ? (x) : (y))
+
+// Runs shorter than this are insertion sorted before merging.
+#define INSERTION_RUN 32
+
+// Int lists shorter than this aren't worth the radix sort's extra pass and buffer.
+#define RADIX_SORT_MIN 64
+
+// Lists at least this long are sorted on several threads, each given at least
+// PARALLEL_CHUNK_MIN items.
+#define PARALLEL_SORT_MIN 4096
+#define PARALLEL_CHUNK_MIN 1024
+#define MAX_SORT_WORKERS 16
+
+static int compare_by(func_2 by, Value left, Value right)
+{
+    if (by == NULL)
+        return compare(left, right);
+
+    Value result = by(left, right);
+    int order = is_int(result) ? result.i : 0;
+    decref(result);
+    return order;
+}
+
+static void insertion_sort(Value* items, u32 count, func_2 by)
+{
+    for (u32 i=1; i < count; i++) {
+        Value item = items[i];
+        u32 j = i;
+        while (j > 0 && compare_by(by, items[j - 1], item) > 0) {
+            items[j] = items[j - 1];
+            j--;
+        }
+        items[j] = item;
+    }
+}
+
+// Merge two sorted spans into 'dest'. Ties take from 'left', which keeps the sort stable.
+static void merge(Value* left, u32 left_count, Value* right, u32 right_count, Value* dest,
+    func_2 by)
+{
+    u32 l = 0, r = 0;
+
+    // Already in order, such as presorted input.
+    if (left_count == 0 || right_count == 0
+            || compare_by(by, left[left_count - 1], right[0]) <= 0) {
+        memcpy(dest, left, sizeof(Value) * left_count);
+        memcpy(dest + left_count, right, sizeof(Value) * right_count);
+        return;
+    }
+
+    while (l < left_count && r < right_count) {
+        if (compare_by(by, right[r], left[l]) < 0)
+            *dest++ = right[r++];
+        else
+            *dest++ = left[l++];
+    }
+
+    memcpy(dest, left + l, sizeof(Value) * (left_count - l));
+    dest += left_count - l;
+    memcpy(dest, right + r, sizeof(Value) * (right_count - r));
+}
+
+// Bottom-up merge sort, ping-ponging between 'items' and 'buffer', which holds at
+// least 'count' items.
+static void merge_sort_with_buffer(Value* items, u32 count, func_2 by, Value* buffer)
+{
+    for (u32 start=0; start < count; start += INSERTION_RUN)
+        insertion_sort(items + start, min(INSERTION_RUN, count - start), by);
+
+    Value* source = items;
+    Value* dest = buffer;
+
+    for (u32 width=INSERTION_RUN; width < count; width *= 2) {
+        for (u32 start=0; start < count; start += width * 2) {
+            u32 mid = min(start + width, count);
+            u32 end = min(start + width * 2, count);
+            merge(source + start, mid - start, source + mid, end - mid, dest + start, by);
+        }
+
+        Value* swap = source;
+        source = dest;
+        dest = swap;
+    }
+
+    if (source != items)
+        memcpy(items, source, sizeof(Value) * count);
+}
+
+static void merge_sort(Value* items, u32 count, func_2 by)
+{
+    if (count <= INSERTION_RUN) {
+        insertion_sort(items, count, by);
+        return;
+    }
+
+    Value* buffer = malloc(sizeof(Value) * count);
+    merge_sort_with_buffer(items, count, by, buffer);
+    free(buffer);
+}
+
+static bool all_ints(Value* items, u32 count)
+{
+    for (u32 i=0; i < count; i++)
+        if (!is_int(items[i]))
+            return false;
+    return true;
+}
+
+// Flip the sign bit so that negative ints order before positive ones as unsigned.
+static u8 radix_digit(Value item, int shift)
+{
+    return (((u32) item.i ^ 0x80000000u) >> shift) & 0xff;
+}
+
+// LSD radix sort over the four bytes of an int, one counting pass per byte. Passes
+// where every item has the same digit are skipped.
+static void radix_sort_ints(Value* items, u32 count)
+{
+    Value* buffer = malloc(sizeof(Value) * count);
+    Value* source = items;
+    Value* dest = buffer;
+
+    for (int shift=0; shift < 32; shift += 8) {
+        u32 offsets[256] = {0};
+        for (u32 i=0; i < count; i++)
+            offsets[radix_digit(source[i], shift)]++;
+
+        if (offsets[radix_digit(source[0], shift)] == count)
+            continue;
+
+        u32 total = 0;
+        for (int d=0; d < 256; d++) {
+            u32 digit_count = offsets[d];
+            offsets[d] = total;
+            total += digit_count;
+        }
+
+        for (u32 i=0; i < count; i++)
+            dest[offsets[radix_digit(source[i], shift)]++] = source[i];
+
+        Value* swap = source;
+        source = dest;
+        dest = swap;
+    }
+
+    if (source != items)
+        memcpy(items, source, sizeof(Value) * count);
+
+    free(buffer);
+}
+
+// Parallel sort: chunks are merge sorted on separate threads, then merged in rounds.
+// Each merge in a round is split across several threads along its merge path. Workers
+// only compare and move items, and all buffers are allocated up front.
+
+typedef struct SortChunk {
+    Value* items;
+    u32 count;
+    Value* buffer;
+} SortChunk;
+
+typedef struct SortMerge {
+    Value* left;
+    u32 left_count;
+    Value* right;
+    u32 right_count;
+    Value* dest;
+} SortMerge;
+
+static void sort_chunk(void* arg)
+{
+    SortChunk* chunk = (SortChunk*) arg;
+    merge_sort_with_buffer(chunk->items, chunk->count, NULL, chunk->buffer);
+}
+
+static void sort_merge(void* arg)
+{
+    SortMerge* task = (SortMerge*) arg;
+    merge(task->left, task->left_count, task->right, task->right_count, task->dest, NULL);
+}
+
+// The number of items taken from 'left' in the first 'diagonal' outputs of a stable merge.
+static u32 merge_path_split(Value* left, u32 left_count, Value* right, u32 right_count,
+    u32 diagonal)
+{
+    u32 low = diagonal > right_count ? diagonal - right_count : 0;
+    u32 high = min(diagonal, left_count);
+
+    while (low < high) {
+        u32 mid = (low + high) / 2;
+        if (compare(left[mid], right[diagonal - mid - 1]) <= 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Items must compare without iterators (which incref), so only leaf values and flat
+// blobs and symbols qualify.
+static bool can_sort_in_parallel(Value* items, u32 count)
+{
+    for (u32 i=0; i < count; i++) {
+        Value item = items[i];
+        if (is_object(item) && !(is_flat_block(item) && (is_blob(item) || is_symbol(item))))
+            return false;
+    }
+    return true;
+}
+
+// A power of two, so that merge rounds pair up evenly.
+static int sort_worker_count(u32 count)
+{
+    int limit = min(parallel_thread_count(), MAX_SORT_WORKERS);
+    int workers = 1;
+    while (workers * 2 <= limit && count / (workers * 2) >= PARALLEL_CHUNK_MIN)
+        workers *= 2;
+    return workers;
+}
+
+static void parallel_sort(Value* items, u32 count, int workers)
+{
+    Value* buffer = malloc(sizeof(Value) * count);
+    void* args[MAX_SORT_WORKERS];
+
+    SortChunk chunks[MAX_SORT_WORKERS];
+    u32 chunk_size = (count + workers - 1) / workers;
+    for (int w=0; w < workers; w++) {
+        u32 start = min(w * chunk_size, count);
+        u32 end = min(start + chunk_size, count);
+        chunks[w].items = items + start;
+        chunks[w].count = end - start;
+        chunks[w].buffer = buffer + start;
+        args[w] = &chunks[w];
+    }
+    parallel_run(sort_chunk, args, workers);
+
+    Value* source = items;
+    Value* dest = buffer;
+
+    for (u32 width=chunk_size; width < count; width *= 2) {
+        SortMerge merges[MAX_SORT_WORKERS];
+        int merge_count = 0;
+        u32 pair_count = (count + width * 2 - 1) / (width * 2);
+        u32 splits = workers / pair_count;
+
+        for (u32 start=0; start < count; start += width * 2) {
+            u32 mid = min(start + width, count);
+            u32 end = min(start + width * 2, count);
+            Value* left = source + start;
+            Value* right = source + mid;
+            u32 left_count = mid - start;
+            u32 right_count = end - mid;
+
+            u32 prev_left = 0, prev_right = 0;
+            for (u32 p=1; p <= splits; p++) {
+                u32 diagonal = (u32) ((u64) (left_count + right_count) * p / splits);
+                u32 take_left = merge_path_split(left, left_count, right, right_count, diagonal);
+                u32 take_right = diagonal - take_left;
+
+                SortMerge* task = &merges[merge_count++];
+                task->left = left + prev_left;
+                task->left_count = take_left - prev_left;
+                task->right = right + prev_right;
+                task->right_count = take_right - prev_right;
+                task->dest = dest + start + prev_left + prev_right;
+
+                prev_left = take_left;
+                prev_right = take_right;
+            }
+        }
+
+        for (int m=0; m < merge_count; m++)
+            args[m] = &merges[m];
+        parallel_run(sort_merge, args, merge_count);
+
+        Value* swap = source;
+        source = dest;
+        dest = swap;
+    }
+
+    if (source != items)
+        memcpy(items, source, sizeof(Value) * count);
+
+    free(buffer);
+}
+
+void sort_values(Value* items, u32 count, func_2 by)
+{
+    if (count < 2)
+        return;
+
+    // The default order on ints is numeric, and equal ints are indistinguishable, so
+    // radix sort gives the same result as a stable comparison sort.
+    if (by == NULL && count >= RADIX_SORT_MIN && all_ints(items, count)) {
+        stat_inc(stat_sort_radix);
+        radix_sort_ints(items, count);
+        return;
+    }
+
+    if (by == NULL && count >= PARALLEL_SORT_MIN && can_sort_in_parallel(items, count)) {
+        int workers = sort_worker_count(count);
+        if (workers > 1) {
+            stat_inc(stat_sort_parallel);
+            parallel_sort(items, count, workers);
+            return;
+        }
+    }
+
+    merge_sort(items, count, by);
+}
+
+Value sort(Value list)
+{
+    return sort_by(list, NULL);
+}
+
+Value sort_by(Value list, func_2 by)
+{
+    if (!is_object(list))
+        return list;
+
+    assert(is_list(list));
+
+    list = writeable_flat(list);
+    sort_values((Value*) list.flat->data, length(list), by);
+    return list;
+}
+
+// Selection. Entries carry their original position, which breaks ties, so results
+// match a stable sort exactly.
+
+typedef struct SortEntry {
+    Value item;
+    u32 index;
+} SortEntry;
+
+static int compare_entries(func_2 by, SortEntry* left, SortEntry* right)
+{
+    int order = compare_by(by, left->item, right->item);
+    if (order != 0)
+        return order;
+    return left->index < right->index ? -1 : (left->index > right->index);
+}
+
+static void swap_entries(SortEntry* entries, u32 a, u32 b)
+{
+    SortEntry swap = entries[a];
+    entries[a] = entries[b];
+    entries[b] = swap;
+}
+
+// Max-heap, so the root is the entry that sorts last.
+static void heap_sift_down(SortEntry* heap, u32 count, u32 i, func_2 by)
+{
+    while (1) {
+        u32 largest = i;
+        u32 left = i * 2 + 1;
+        u32 right = i * 2 + 2;
+        if (left < count && compare_entries(by, &heap[left], &heap[largest]) > 0)
+            largest = left;
+        if (right < count && compare_entries(by, &heap[right], &heap[largest]) > 0)
+            largest = right;
+        if (largest == i)
+            return;
+        swap_entries(heap, i, largest);
+        i = largest;
+    }
+}
+
+static void heap_sift_up(SortEntry* heap, u32 i, func_2 by)
+{
+    while (i > 0) {
+        u32 parent = (i - 1) / 2;
+        if (compare_entries(by, &heap[i], &heap[parent]) <= 0)
+            return;
+        swap_entries(heap, i, parent);
+        i = parent;
+    }
+}
+
+static void heap_sort_entries(SortEntry* entries, u32 count, func_2 by)
+{
+    for (u32 i=count / 2; i > 0; i--)
+        heap_sift_down(entries, count, i - 1, by);
+
+    for (u32 end=count; end > 1; end--) {
+        swap_entries(entries, 0, end - 1);
+        heap_sift_down(entries, end - 1, 0, by);
+    }
+}
+
+// Introselect: quickselect with a median-of-three pivot, falling back to heap sort
+// on the remaining range if partitioning keeps going badly.
+static void select_entries(SortEntry* entries, u32 count, u32 target, func_2 by)
+{
+    u32 low = 0;
+    u32 high = count;
+    int depth_limit = 2;
+    for (u32 n=count; n > 1; n /= 2)
+        depth_limit += 2;
+
+    while (high - low > 1) {
+        if (depth_limit-- == 0) {
+            heap_sort_entries(entries + low, high - low, by);
+            return;
+        }
+
+        u32 mid = low + (high - low) / 2;
+        u32 last = high - 1;
+        if (compare_entries(by, &entries[mid], &entries[low]) < 0)
+            swap_entries(entries, mid, low);
+        if (compare_entries(by, &entries[last], &entries[low]) < 0)
+            swap_entries(entries, last, low);
+        if (compare_entries(by, &entries[mid], &entries[last]) < 0)
+            swap_entries(entries, mid, last);
+
+        // The median is now at 'last'.
+        u32 store = low;
+        for (u32 i=low; i < last; i++)
+            if (compare_entries(by, &entries[i], &entries[last]) < 0)
+                swap_entries(entries, i, store++);
+        swap_entries(entries, store, last);
+
+        if (target == store)
+            return;
+        if (target < store)
+            high = store;
+        else
+            low = store + 1;
+    }
+}
+
+Value top_k(Value list, int k, func_2 by)
+{
+    u32 count = length(list);
+    if (k <= 0 || count == 0) {
+        decref(list);
+        return empty_list();
+    }
+    if ((u32) k > count)
+        k = count;
+
+    // Bounded heap of the best k so far. Its root is the worst of them.
+    SortEntry* heap = malloc(sizeof(SortEntry) * k);
+    u32 heap_count = 0;
+    u32 index = 0;
+
+    for_each_section(list, it) {
+        u32 size;
+        Value* items = (Value*) iterator_get_section(&it, &size);
+        for (u32 i=0; i < size / sizeof(Value); i++, index++) {
+            SortEntry entry = { items[i], index };
+            if (heap_count < (u32) k) {
+                heap[heap_count] = entry;
+                heap_sift_up(heap, heap_count++, by);
+            } else if (compare_entries(by, &entry, &heap[0]) < 0) {
+                heap[0] = entry;
+                heap_sift_down(heap, heap_count, 0, by);
+            }
+        }
+    }
+
+    heap_sort_entries(heap, heap_count, by);
+
+    Flat* flat = new_flat(LIST_TYPE, sizeof(Value) * heap_count);
+    for (u32 i=0; i < heap_count; i++)
+        ((Value*) flat->data)[i] = incref(heap[i].item);
+
+    free(heap);
+    decref(list);
+    return ptr_value(flat);
+}
+
+Value nth_sorted(Value list, int index, func_2 by)
+{
+    u32 count = length(list);
+    if (index < 0 || (u32) index >= count) {
+        decref(list);
+        return nil_value();
+    }
+
+    SortEntry* entries = malloc(sizeof(SortEntry) * count);
+    u32 pos = 0;
+    for_each_section(list, it) {
+        u32 size;
+        Value* items = (Value*) iterator_get_section(&it, &size);
+        for (u32 i=0; i < size / sizeof(Value); i++, pos++) {
+            entries[pos].item = items[i];
+            entries[pos].index = pos;
+        }
+    }
+
+    select_entries(entries, count, index, by);
+    Value result = incref(entries[index].item);
+
+    free(entries);
+    decref(list);
+    return result;
+}
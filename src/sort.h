@@ -0,0 +1,5 @@
+
+#pragma once
+
+// Stable sort of 'count' items in place. A NULL 'by' sorts with compare().
+void sort_values(Value* items, u32 count, func_2 by);
@@ -0,0 +1,495 @@
+
+#include "ice_internal_headers.h"
+
+#include "blob.h"
+#include "block.h"
+#include "list.h"
+#include "strings.h"
+#include "swar.h"
+#include "text.h"
+#include "value.h"
+
+#define min(x,y) ((x) < (y) ? (x) : (y))
+
+// Pieces returned by these functions are slices of the source, so no bytes are copied.
+
+// Largest number of pieces that fit in one list block.
+#define MAX_PIECES (0xffff / sizeof(Value))
+
+static bool is_whitespace(u8 c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// A slice of 'str' covering [start, start + size).
+static Value string_piece(Value str, u32 start, u32 size)
+{
+    if (size == 0)
+        return empty_blob();
+    if (start == 0 && size == block_size(str))
+        return incref(str);
+
+    return byte_slice(incref(str), start, size);
+}
+
+typedef struct PieceList {
+    Value* items;
+    u32 count;
+    u32 capacity;
+
+    // Set if there were more pieces than fit in one list. The result is nil.
+    bool overflow;
+} PieceList;
+
+static void piece_list_add(PieceList* list, Value piece /*consumed*/)
+{
+    if (list->count >= MAX_PIECES) {
+        list->overflow = true;
+        decref(piece);
+        return;
+    }
+
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+        list->items = realloc(list->items, sizeof(Value) * list->capacity);
+    }
+    list->items[list->count++] = piece;
+}
+
+static Value piece_list_finish(PieceList* list)
+{
+    if (list->overflow) {
+        for (u32 i=0; i < list->count; i++)
+            decref(list->items[i]);
+        free(list->items);
+        return nil_value();
+    }
+
+    Flat* flat = new_flat(LIST_TYPE, sizeof(Value) * list->count);
+    memcpy(flat->data, list->items, sizeof(Value) * list->count);
+    free(list->items);
+    return ptr_value(flat);
+}
+
+// KMP failure table: fail[i] is the length of the longest proper prefix of
+// sep[0..i] that is also a suffix of it.
+static void build_failure_table(const u8* sep, u32 size, u32* fail)
+{
+    fail[0] = 0;
+    u32 k = 0;
+    for (u32 i=1; i < size; i++) {
+        while (k > 0 && sep[i] != sep[k])
+            k = fail[k - 1];
+        if (sep[i] == sep[k])
+            k++;
+        fail[i] = k;
+    }
+}
+
+Value string_split(Value str, Value sep)
+{
+    u32 sep_size = block_size(sep);
+    assert(sep_size > 0);
+
+    PieceList pieces = { NULL, 0, 0, false };
+
+    // The separator is small, so it's copied out once. The source is scanned section by
+    // section, and matches may straddle sections.
+    u8* sep_bytes = malloc(sep_size);
+    u32* fail = malloc(sizeof(u32) * sep_size);
+    u32 pos = 0;
+    for_each_section(sep, it) {
+        u32 size;
+        u8* section = iterator_get_section(&it, &size);
+        memcpy(sep_bytes + pos, section, size);
+        pos += size;
+    }
+
+    // Text is only split on code point boundaries. A separator that is valid UTF-8 only
+    // matches on them, and one that isn't never matches.
+    if (is_text(str) && !is_valid_utf8(sep_bytes, sep_size)) {
+        free(sep_bytes);
+        free(fail);
+        decref(sep);
+        return list1(str);
+    }
+
+    build_failure_table(sep_bytes, sep_size, fail);
+
+    u32 piece_start = 0;
+    u32 matched = 0;
+    u32 offset = 0;
+
+    for_each_section(str, it) {
+        u32 size;
+        u8* section = iterator_get_section(&it, &size);
+
+        if (sep_size == 1) {
+            u8* cursor = section;
+            u8* found;
+            while ((found = memchr(cursor, sep_bytes[0], section + size - cursor)) != NULL) {
+                u32 match_start = offset + (found - section);
+                piece_list_add(&pieces, string_piece(str, piece_start, match_start - piece_start));
+                piece_start = match_start + 1;
+                cursor = found + 1;
+            }
+        } else {
+            for (u32 i=0; i < size; i++) {
+                while (matched > 0 && section[i] != sep_bytes[matched])
+                    matched = fail[matched - 1];
+                if (section[i] == sep_bytes[matched])
+                    matched++;
+
+                if (matched == sep_size) {
+                    u32 match_start = offset + i + 1 - sep_size;
+                    piece_list_add(&pieces, string_piece(str, piece_start, match_start - piece_start));
+                    piece_start = offset + i + 1;
+                    matched = 0;
+                }
+            }
+        }
+
+        offset += size;
+    }
+
+    piece_list_add(&pieces, string_piece(str, piece_start, block_size(str) - piece_start));
+
+    free(sep_bytes);
+    free(fail);
+    decref2(str, sep);
+    return piece_list_finish(&pieces);
+}
+
+Value string_join(Value list, Value sep)
+{
+    u32 count = length(list);
+    if (count == 0) {
+        decref2(list, sep);
+        return empty_blob();
+    }
+
+    // Items alternate with the separator, then the whole run is concatenated as a
+    // balanced tree, so the result stays shallow however many items there are.
+    u32 total_size = block_size(sep) * (count - 1);
+    for_each_list_item(list, it)
+        total_size += block_size(iterator_get_val(&it));
+
+    if (total_size > MAX_BLOB_SIZE) {
+        decref2(list, sep);
+        return nil_value();
+    }
+
+    u32 part_count = count * 2 - 1;
+    Value* parts = malloc(sizeof(Value) * part_count);
+    u32 i = 0;
+    for_each_list_item(list, it) {
+        Value item = iterator_get_val(&it);
+        assert(is_blob(item));
+        if (i > 0)
+            parts[i * 2 - 1] = incref(sep);
+        parts[i * 2] = incref(item);
+        i++;
+    }
+
+    Value result = concat_balanced(parts, part_count);
+    free(parts);
+    decref2(list, sep);
+    return result;
+}
+
+Value string_trim(Value str)
+{
+    u32 first = 0;
+    u32 end = 0;
+    bool found = false;
+    u32 offset = 0;
+
+    for_each_section(str, it) {
+        u32 size;
+        u8* section = iterator_get_section(&it, &size);
+        for (u32 i=0; i < size; i++) {
+            if (is_whitespace(section[i]))
+                continue;
+            if (!found)
+                first = offset + i;
+            found = true;
+            end = offset + i + 1;
+        }
+        offset += size;
+    }
+
+    Value result = string_piece(str, first, end - first);
+    decref(str);
+    return result;
+}
+
+// Byte kernels, eight bytes at a time.
+
+typedef void (*byte_kernel)(u8* dest, const u8* src, u32 size, u8 arg1, u8 arg2);
+
+// Flip the case bit (0x20) of every byte in [low, high], which must be ASCII.
+static void flip_case_kernel(u8* dest, const u8* src, u32 size, u8 low, u8 high)
+{
+    u64 add_low = (0x80 - low) * BYTES_01;
+    u64 add_high = (0x80 - high - 1) * BYTES_01;
+    u32 i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        u64 word = load_u64(src + i);
+        // Work on the low seven bits so adds can't carry between bytes. The high bit of
+        // each sum says whether the byte is >= low, or > high.
+        u64 heptets = word & BYTES_7F;
+        u64 in_range = (heptets + add_low) & ~(heptets + add_high) & ~word & BYTES_80;
+        store_u64(dest + i, word ^ (in_range >> 2));
+    }
+
+    for (; i < size; i++) {
+        u8 c = src[i];
+        dest[i] = (c >= low && c <= high) ? c ^ 0x20 : c;
+    }
+}
+
+static void replace_byte_kernel(u8* dest, const u8* src, u32 size, u8 from, u8 to)
+{
+    u64 from_bytes = from * BYTES_01;
+    u64 to_bytes = to * BYTES_01;
+    u32 i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        u64 word = load_u64(src + i);
+        u64 mask = (zero_byte_mask(word ^ from_bytes) >> 7) * 0xff;
+        store_u64(dest + i, (word & ~mask) | (to_bytes & mask));
+    }
+
+    for (; i < size; i++)
+        dest[i] = src[i] == from ? to : src[i];
+}
+
+// Run a kernel over every section of 'str', writing into one flat of the same size.
+// An unshared flat is rewritten in place.
+//
+// The kernels only touch bytes that equal their arguments or lie between them. With
+// ASCII arguments, text stays valid and its code points stay where they were, so its
+// index still holds. Otherwise text is copied as a blob and checked again, which
+// rebuilds the index.
+static Value map_bytes(Value str, byte_kernel kernel, u8 arg1, u8 arg2)
+{
+    if (!is_object(str))
+        return str;
+
+    bool text = is_text(str);
+    bool keeps_text = arg1 < 0x80 && arg2 < 0x80;
+
+    if (is_flat_block(str) && is_writeable_object(str) && (!text || keeps_text)) {
+        kernel(str.flat->data, str.flat->data, block_size(str), arg1, arg2);
+        str.object->hash = 0;
+        return str;
+    }
+
+    Flat* flat = new_flat(text ? BLOB_TYPE : str.object->logical_type, block_size(str));
+    u32 offset = 0;
+    for_each_section(str, it) {
+        u32 size;
+        u8* section = iterator_get_section(&it, &size);
+        kernel(flat->data + offset, section, size, arg1, arg2);
+        offset += size;
+    }
+
+    decref(str);
+
+    if (text)
+        return text_from_blob(ptr_value(flat));
+    return ptr_value(flat);
+}
+
+Value string_upper(Value str)
+{
+    return map_bytes(str, flip_case_kernel, 'a', 'z');
+}
+
+Value string_lower(Value str)
+{
+    return map_bytes(str, flip_case_kernel, 'A', 'Z');
+}
+
+Value string_replace_byte(Value str, u8 from, u8 to)
+{
+    return map_bytes(str, replace_byte_kernel, from, to);
+}
+
+bool is_ascii(Value str)
+{
+    for_each_section(str, it) {
+        u32 size;
+        u8* section = iterator_get_section(&it, &size);
+
+        u64 bits = 0;
+        u32 i = 0;
+        for (; i + 8 <= size; i += 8)
+            bits |= load_u64(section + i);
+        for (; i < size; i++)
+            bits |= section[i];
+
+        if (bits & BYTES_80) {
+            iterator_stop(&it);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Search. Offsets are from the start of the blob, so they can be passed to byte_slice.
+
+// First match of 'needle' in one contiguous span, at or after 'from'. Candidates are
+// found eight positions at a time: a position is a candidate if both the first and the
+// last byte of the needle match there. Only candidates get a full compare.
+static int search_span(const u8* data, u32 size, const u8* needle, u32 needle_size, u32 from)
+{
+    if (needle_size > size || from > size - needle_size)
+        return -1;
+
+    if (needle_size == 1) {
+        const u8* found = memchr(data + from, needle[0], size - from);
+        return found == NULL ? -1 : (int) (found - data);
+    }
+
+    u32 last_start = size - needle_size;
+    u64 first_bytes = needle[0] * BYTES_01;
+    u64 last_bytes = needle[needle_size - 1] * BYTES_01;
+    u32 i = from;
+
+    for (; i + 7 <= last_start; i += 8) {
+        u64 candidates = zero_byte_mask(load_u64(data + i) ^ first_bytes)
+            & zero_byte_mask(load_u64(data + i + needle_size - 1) ^ last_bytes);
+
+        while (candidates != 0) {
+            u32 pos = i + __builtin_ctzll(candidates) / 8;
+            if (memcmp(data + pos + 1, needle + 1, needle_size - 2) == 0)
+                return pos;
+            candidates &= candidates - 1;
+        }
+    }
+
+    for (; i <= last_start; i++)
+        if (data[i] == needle[0] && memcmp(data + i, needle, needle_size) == 0)
+            return i;
+
+    return -1;
+}
+
+static u8* copy_bytes(Value blob)
+{
+    u8* bytes = malloc(block_size(blob));
+    u32 offset = 0;
+    for_each_section(blob, it) {
+        u32 size;
+        u8* section = iterator_get_section(&it, &size);
+        memcpy(bytes + offset, section, size);
+        offset += size;
+    }
+    return bytes;
+}
+
+// Keep the last 'keep' bytes of the stream in 'carry' after 'section'. Returns the new
+// carry length.
+static u32 update_carry(u8* carry, u32 carry_len, u32 keep, const u8* section, u32 size)
+{
+    if (size >= keep) {
+        memcpy(carry, section + size - keep, keep);
+        return keep;
+    }
+
+    u32 kept = min(carry_len, keep - size);
+    memmove(carry, carry + carry_len - kept, kept);
+    memcpy(carry + kept, section, size);
+    return kept + size;
+}
+
+int find(Value blob, Value needle, u32 start)
+{
+    u32 needle_size = block_size(needle);
+    if (needle_size == 0)
+        return start <= block_size(blob) ? (int) start : -1;
+    if (needle_size > block_size(blob))
+        return -1;
+
+    // The needle is copied out once. Matches inside a section are searched in place.
+    // A match that straddles sections starts within the last needle_size - 1 bytes seen,
+    // so those are kept in 'carry', and searched with the head of the next section.
+    u8* pattern = copy_bytes(needle);
+    u32 keep = needle_size - 1;
+    u8* carry = keep > 0 ? malloc(keep * 2) : NULL;
+    u32 carry_len = 0;
+    u32 offset = 0;
+    int result = -1;
+
+    for_each_section(blob, it) {
+        u32 size;
+        u8* section = iterator_get_section(&it, &size);
+
+        if (carry_len > 0) {
+            u32 head = min(size, keep);
+            memcpy(carry + carry_len, section, head);
+            u32 carry_offset = offset - carry_len;
+            u32 from = start > carry_offset ? start - carry_offset : 0;
+            int found = search_span(carry, carry_len + head, pattern, needle_size, from);
+            if (found >= 0 && (u32) found < carry_len) {
+                result = carry_offset + found;
+                iterator_stop(&it);
+                break;
+            }
+        }
+
+        u32 from = start > offset ? start - offset : 0;
+        int found = search_span(section, size, pattern, needle_size, from);
+        if (found >= 0) {
+            result = offset + found;
+            iterator_stop(&it);
+            break;
+        }
+
+        if (keep > 0)
+            carry_len = update_carry(carry, carry_len, keep, section, size);
+
+        offset += size;
+    }
+
+    free(pattern);
+    if (carry != NULL)
+        free(carry);
+    return result;
+}
+
+bool contains(Value blob, Value needle)
+{
+    return find(blob, needle, 0) >= 0;
+}
+
+int find_any(Value blob, Value byte_set, u32 start)
+{
+    if (block_size(byte_set) == 1)
+        return find(blob, byte_set, start);
+
+    bool in_set[256] = {0};
+    for_each_section(byte_set, it) {
+        u32 size;
+        u8* section = iterator_get_section(&it, &size);
+        for (u32 i=0; i < size; i++)
+            in_set[section[i]] = true;
+    }
+
+    u32 offset = 0;
+    for_each_section(blob, it) {
+        u32 size;
+        u8* section = iterator_get_section(&it, &size);
+        for (u32 i=start > offset ? start - offset : 0; i < size; i++) {
+            if (in_set[section[i]]) {
+                iterator_stop(&it);
+                return offset + i;
+            }
+        }
+        offset += size;
+    }
+
+    return -1;
+}
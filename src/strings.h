@@ -0,0 +1,13 @@
+
+#pragma once
+
+Value string_split(Value str /*consumed*/, Value sep /*consumed*/);
+Value string_join(Value list /*consumed*/, Value sep /*consumed*/);
+Value string_trim(Value str /*consumed*/);
+Value string_upper(Value str /*consumed*/);
+Value string_lower(Value str /*consumed*/);
+Value string_replace_byte(Value str /*consumed*/, u8 from, u8 to);
+bool is_ascii(Value str);
+int find(Value blob, Value needle, u32 start);
+int find_any(Value blob, Value byte_set, u32 start);
+bool contains(Value blob, Value needle);
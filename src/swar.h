@@ -0,0 +1,28 @@
+
+#pragma once
+
+// Helpers for working on eight bytes at a time in a u64 (SWAR). They need no particular
+// instruction set, and any alignment is fine.
+
+#define BYTES_01 0x0101010101010101ull
+#define BYTES_7F 0x7f7f7f7f7f7f7f7full
+#define BYTES_80 0x8080808080808080ull
+
+static inline u64 load_u64(const u8* src)
+{
+    u64 word;
+    memcpy(&word, src, 8);
+    return word;
+}
+
+static inline void store_u64(u8* dest, u64 word)
+{
+    memcpy(dest, &word, 8);
+}
+
+// The high bit of each byte is set if that byte of 'word' is zero, with no false
+// positives from borrows.
+static inline u64 zero_byte_mask(u64 word)
+{
+    return ~(((word & BYTES_7F) + BYTES_7F) | word) & BYTES_80;
+}
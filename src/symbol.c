@@ -2,11 +2,36 @@
 #include "ice_internal_headers.h"
 
 #include "block.h"
+#include "format.h"
+#include "hash.h"
+#include "intern.h"
 #include "symbol.h"
 #include "value.h"
 
 int g_nextGensymId = 1;
 
+// Every symbol has exactly one permanent block, so symbols compare by pointer.
+InternTable g_symbols;
+
+Value symbol_from_bytes(const u8* data, u32 size)
+{
+    u32 hash = hashcode_bytes(SYMBOL_TYPE, data, size);
+    Value existing = intern_table_find_bytes(&g_symbols, SYMBOL_TYPE, data, size, hash);
+    if (existing.raw != 0)
+        return existing;
+
+    Flat* flat = new_flat(SYMBOL_TYPE, size);
+    memcpy(flat->data, data, size);
+    Value result = make_perm(ptr_value(flat));
+    intern_table_insert(&g_symbols, result);
+    return result;
+}
+
+Value symbol(const char* str)
+{
+    return symbol_from_bytes((const u8*) str, strlen(str));
+}
+
 bool is_symbol(Value value)
 {
     return get_logical_type(value) == SYMBOL_TYPE;
@@ -16,12 +41,22 @@ Value gensym(Value str)
 {
     check_value(str);
 
-    if (!is_blob(str) && !is_symbol(str))
-        str = stringify(str);
+    BlobBuilder builder;
+    blob_builder_start(&builder, 32);
+
+    if (is_blob(str) || is_symbol(str))
+        blob_builder_append_blob(&builder, str);
+    else
+        stringify_to_builder(&builder, str);
+    decref(str);
+
+    char* dest = (char*) blob_builder_reserve(&builder, 1 + FORMAT_INT_MAX);
+    dest[0] = '#';
+    blob_builder_commit(&builder, 1 + format_int(dest + 1, g_nextGensymId++));
 
-    str = append_str_len(str, "#", 1);
-    str = stringify_append(str, int_value(g_nextGensymId++));
-    str = set_logical_type(str, SYMBOL_TYPE);
-    return str;
+    Value name = blob_builder_finish(&builder);
+    Value result = symbol_from_bytes(name.flat->data, name.flat->header.size);
+    decref(name);
+    return result;
 }
 
@@ -2,3 +2,4 @@
 #pragma once
 
 bool is_symbol(Value value);
+Value symbol_from_bytes(const u8* data, u32 size);
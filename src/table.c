@@ -1,69 +1,360 @@
-
-#include "ice_internal_headers.h"
-
-#include "list.h"
-#include "table.h"
-#include "value.h"
-
-Value table0()
-{
-    return empty_table();
-}
-
-Value table1(Value k, Value v)
-{
-    Value table = list2(k, v);
-    table.object->logical_type = TABLE_TYPE;
-    table.object->layout = TABLE_LAYOUT_UNINDEXED_LIST;
-    return table;
-}
-
-Value table2(Value k1, Value v1, Value k2, Value v2)
-{
-    assert(false);
-    return nil_value();
-}
-
-Value table3(Value k1, Value v1, Value k2, Value v2, Value k3, Value v3)
-{
-    assert(false);
-    return nil_value();
-}
-
-Value table4(Value k1, Value v1, Value k2, Value v2,
-    Value k3, Value v3, Value k4, Value v4)
-{
-    assert(false);
-    return nil_value();
-}
-
-Value table5(Value k1, Value v1, Value k2, Value v2, Value k3, Value v3,
-    Value k4, Value v4, Value k5, Value v5)
-{
-    assert(false);
-    return nil_value();
-}
-
-Value keys(Value table)
-{
-    assert(false);
-    return nil_value();
-}
-
-Value values(Value table)
-{
-    assert(false);
-    return nil_value();
-}
-
-Value insert(Value table, Value key, Value val)
-{
-    assert(false);
-    return nil_value();
-}
-
-Value delete_key(Value table, Value key)
-{
-    assert(false);
-    return nil_value();
-}
+
+#include "ice_internal_headers.h"
+
+#include "block.h"
+#include "list.h"
+#include "table.h"
+#include "value.h"
+
+// Largest number of pairs that fit in one block.
+#define MAX_TABLE_PAIRS (0xffff / (sizeof(Value) * 2))
+
+typedef struct TableBuilder {
+    Flat* flat;
+    TableIndex* index;
+    u16 count;
+    u16 max_count;
+
+    // Set if a new key didn't fit. The result is nil.
+    bool overflow;
+} TableBuilder;
+
+static Value* table_pairs(Value table)
+{
+    return (Value*) table.flat->data;
+}
+
+static TableIndex* table_index(Value table)
+{
+    assert(table.object->layout == TABLE_LAYOUT_INDEXED_LIST);
+    return (TableIndex*) (table.flat->data + table.flat->header.size);
+}
+
+static u16 index_capacity_for(u32 count)
+{
+    // Keep the load factor at or under 50%, so probes stay short.
+    u32 capacity = 4;
+    while (capacity < count * 2)
+        capacity *= 2;
+    return capacity;
+}
+
+// 'max_count' can be more than fits, since duplicate keys may bring the count back
+// down. If it really doesn't fit, the builder finishes with nil.
+static void table_builder_start(TableBuilder* builder, u32 max_count)
+{
+    if (max_count > MAX_TABLE_PAIRS)
+        max_count = MAX_TABLE_PAIRS;
+
+    u16 capacity = index_capacity_for(max_count);
+    u32 index_size = sizeof(TableIndex) + sizeof(Bucket) * capacity;
+
+    builder->flat = new_flat_with_trailer(TABLE_TYPE, sizeof(Value) * 2 * max_count, index_size);
+    builder->flat->header.layout = TABLE_LAYOUT_INDEXED_LIST;
+    builder->index = (TableIndex*) (builder->flat->data + builder->flat->header.size);
+    builder->index->capacity = capacity;
+    memset(builder->index->buckets, 0, sizeof(Bucket) * capacity);
+    builder->count = 0;
+    builder->max_count = max_count;
+    builder->overflow = false;
+}
+
+static Bucket* find_bucket(TableIndex* index, Value* pairs, Value key, u32 hash)
+{
+    u16 mask = index->capacity - 1;
+    u16 i = hash & mask;
+
+    while (1) {
+        Bucket* bucket = &index->buckets[i];
+        if (bucket->hashcode == 0)
+            return bucket;
+        if (bucket->hashcode == hash && equals(pairs[bucket->pindex * 2], key))
+            return bucket;
+        i = (i + 1) & mask;
+    }
+}
+
+static void table_builder_add(TableBuilder* builder, Value key /*consumed*/, Value val /*consumed*/)
+{
+    Value* pairs = (Value*) builder->flat->data;
+    u32 hash = hashcode(key);
+    Bucket* bucket = find_bucket(builder->index, pairs, key, hash);
+
+    if (bucket->hashcode != 0) {
+        // Duplicate key: keep the original position, last value wins.
+        Value* pair = pairs + bucket->pindex * 2;
+        decref2(key, pair[1]);
+        pair[1] = val;
+        return;
+    }
+
+    if (builder->count == builder->max_count) {
+        builder->overflow = true;
+        decref2(key, val);
+        return;
+    }
+
+    bucket->hashcode = hash;
+    bucket->pindex = builder->count;
+    pairs[builder->count * 2] = key;
+    pairs[builder->count * 2 + 1] = val;
+    builder->count++;
+}
+
+// Move every pair of an existing table into the builder. Indexed tables already have
+// their hashcodes, so their keys are not rehashed or compared.
+static void table_builder_add_table(TableBuilder* builder, Value table /*consumed*/)
+{
+    if (is_empty_table(table))
+        return;
+
+    u32 count = length(table);
+
+    if (table.object->layout != TABLE_LAYOUT_INDEXED_LIST || builder->count != 0) {
+        for (u32 i=0; i < count; i++)
+            table_builder_add(builder, incref(table_key_by_index(table, i)),
+                incref(table_value_by_index(table, i)));
+        decref(table);
+        return;
+    }
+
+    Value* pairs = (Value*) builder->flat->data;
+    memcpy(pairs, table_pairs(table), sizeof(Value) * 2 * count);
+
+    TableIndex* old_index = table_index(table);
+    u16 mask = builder->index->capacity - 1;
+    for (u32 b=0; b < old_index->capacity; b++) {
+        Bucket* old_bucket = &old_index->buckets[b];
+        if (old_bucket->hashcode == 0)
+            continue;
+        u16 i = old_bucket->hashcode & mask;
+        while (builder->index->buckets[i].hashcode != 0)
+            i = (i + 1) & mask;
+        builder->index->buckets[i] = *old_bucket;
+    }
+
+    builder->count = count;
+
+    if (is_writeable_object(table)) {
+        // Pairs were moved, not copied, so free the old block without touching them.
+        free(table.flat);
+        return;
+    }
+
+    for (u32 i=0; i < count * 2; i++)
+        incref(pairs[i]);
+    decref(table);
+}
+
+static Value table_builder_finish(TableBuilder* builder)
+{
+    if (builder->overflow) {
+        Value* pairs = (Value*) builder->flat->data;
+        for (u32 i=0; i < builder->count * 2; i++)
+            decref(pairs[i]);
+        free(builder->flat);
+        return nil_value();
+    }
+
+    if (builder->count == 0) {
+        free(builder->flat);
+        return empty_table();
+    }
+
+    // Duplicates may have left the pair area short; move the index up against it.
+    Flat* flat = builder->flat;
+    u16 size = sizeof(Value) * 2 * builder->count;
+    if (size != flat->header.size) {
+        memmove(flat->data + size, builder->index,
+            sizeof(TableIndex) + sizeof(Bucket) * builder->index->capacity);
+        flat->header.size = size;
+    }
+
+    return ptr_value(flat);
+}
+
+Value table0()
+{
+    return empty_table();
+}
+
+Value table1(Value k, Value v)
+{
+    Value table = list2(k, v);
+    table.object->logical_type = TABLE_TYPE;
+    table.object->layout = TABLE_LAYOUT_UNINDEXED_LIST;
+    return table;
+}
+
+Value table2(Value k1, Value v1, Value k2, Value v2)
+{
+    Value keys[] = { k1, k2 };
+    Value vals[] = { v1, v2 };
+    return table_from_arrays(keys, vals, 2);
+}
+
+Value table3(Value k1, Value v1, Value k2, Value v2, Value k3, Value v3)
+{
+    Value keys[] = { k1, k2, k3 };
+    Value vals[] = { v1, v2, v3 };
+    return table_from_arrays(keys, vals, 3);
+}
+
+Value table4(Value k1, Value v1, Value k2, Value v2,
+    Value k3, Value v3, Value k4, Value v4)
+{
+    Value keys[] = { k1, k2, k3, k4 };
+    Value vals[] = { v1, v2, v3, v4 };
+    return table_from_arrays(keys, vals, 4);
+}
+
+Value table5(Value k1, Value v1, Value k2, Value v2, Value k3, Value v3,
+    Value k4, Value v4, Value k5, Value v5)
+{
+    Value keys[] = { k1, k2, k3, k4, k5 };
+    Value vals[] = { v1, v2, v3, v4, v5 };
+    return table_from_arrays(keys, vals, 5);
+}
+
+Value table_from_arrays(Value* keys, Value* vals, int count)
+{
+    if (count <= 0)
+        return empty_table();
+
+    TableBuilder builder;
+    table_builder_start(&builder, count);
+    for (int i=0; i < count; i++)
+        table_builder_add(&builder, keys[i], vals[i]);
+    return table_builder_finish(&builder);
+}
+
+Value table_from_pairs(Value pairs)
+{
+    u32 count = length(pairs);
+    if (count == 0) {
+        decref(pairs);
+        return empty_table();
+    }
+
+    TableBuilder builder;
+    table_builder_start(&builder, count);
+
+    for_each_list_item(pairs, it) {
+        Value pair = iterator_get_val(&it);
+        assert(length(pair) == 2);
+        table_builder_add(&builder, incref(nth(pair, 0)), incref(nth(pair, 1)));
+    }
+
+    decref(pairs);
+    return table_builder_finish(&builder);
+}
+
+u32 table_trailer_size(Value table)
+{
+    if (table.object->layout != TABLE_LAYOUT_INDEXED_LIST)
+        return 0;
+    return sizeof(TableIndex) + sizeof(Bucket) * table_index(table)->capacity;
+}
+
+Value table_key_by_index(Value table, int index)
+{
+    return table_pairs(table)[index * 2];
+}
+
+Value table_value_by_index(Value table, int index)
+{
+    return table_pairs(table)[index * 2 + 1];
+}
+
+// The pair with 'key', or NULL.
+static Value* find_pair(Value table, Value key)
+{
+    Value* pairs = table_pairs(table);
+
+    if (table.object->layout != TABLE_LAYOUT_INDEXED_LIST) {
+        u32 count = length(table);
+        for (u32 i=0; i < count; i++)
+            if (equals(pairs[i * 2], key))
+                return &pairs[i * 2];
+        return NULL;
+    }
+
+    Bucket* bucket = find_bucket(table_index(table), pairs, key, hashcode(key));
+    if (bucket->hashcode == 0)
+        return NULL;
+    return &pairs[bucket->pindex * 2];
+}
+
+Value table_get(Value table, Value key)
+{
+    if (!is_hashtable(table))
+        return nil_value();
+
+    Value* pair = find_pair(table, key);
+    if (pair == NULL)
+        return nil_value();
+    return pair[1];
+}
+
+bool table_equals(Value left, Value right)
+{
+    u32 count = length(left);
+    if (length(right) != count)
+        return false;
+
+    // Keys are unique, so every key of 'left' being found in 'right' covers them all.
+    Value* pairs = table_pairs(left);
+    for (u32 i=0; i < count; i++) {
+        Value* pair = find_pair(right, pairs[i * 2]);
+        if (pair == NULL || !equals(pair[1], pairs[i * 2 + 1]))
+            return false;
+    }
+    return true;
+}
+
+Value keys(Value table)
+{
+    u32 count = length(table);
+    if (count == 0)
+        return empty_list();
+
+    Flat* flat = new_flat(LIST_TYPE, sizeof(Value) * count);
+    for (u32 i=0; i < count; i++)
+        ((Value*) flat->data)[i] = incref(table_key_by_index(table, i));
+    return ptr_value(flat);
+}
+
+Value values(Value table)
+{
+    u32 count = length(table);
+    if (count == 0)
+        return empty_list();
+
+    Flat* flat = new_flat(LIST_TYPE, sizeof(Value) * count);
+    for (u32 i=0; i < count; i++)
+        ((Value*) flat->data)[i] = incref(table_value_by_index(table, i));
+    return ptr_value(flat);
+}
+
+Value insert(Value table, Value key, Value val)
+{
+    if (is_empty_table(table))
+        return table1(key, val);
+
+    if (!is_hashtable(table)) {
+        decref2(key, val);
+        return table;
+    }
+
+    TableBuilder builder;
+    table_builder_start(&builder, length(table) + 1);
+    table_builder_add_table(&builder, table);
+    table_builder_add(&builder, key, val);
+    return table_builder_finish(&builder);
+}
+
+Value delete_key(Value table, Value key)
+{
+    assert(false);
+    return nil_value();
+}
@@ -3,6 +3,28 @@
 
 #include "value.h"
 
+// Indexed tables (TABLE_LAYOUT_INDEXED_LIST) are a flat block of key/value pairs,
+// followed by a TableIndex trailer that is not counted in the block size. The index
+// is an open-addressed hash table; a bucket with hashcode 0 is empty.
+
+typedef struct PACKED Bucket {
+    u32 hashcode;
+    u16 pindex;
+} Bucket;
+
+typedef struct PACKED TableIndex {
+    u16 capacity;
+    Bucket buckets[]; // buckets[capacity]
+} TableIndex;
+
+Value table_get(Value table, Value key);
+
+// Same pairs, in any order.
+bool table_equals(Value left, Value right);
+Value table_key_by_index(Value table, int index);
+Value table_value_by_index(Value table, int index);
+u32 table_trailer_size(Value table);
+
 
 #if 0
 typedef struct Bucket_ {
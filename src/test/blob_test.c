@@ -1,10 +1,14 @@
 
+// For fileno()
+#define _POSIX_C_SOURCE 200809L
+
 #include "ice_internal_headers.h"
 
 #include "test_framework.h"
 
 #include "blob.h"
 #include "block.h"
+#include "hash.h"
 #include "value.h"
 
 void test_is_blob()
@@ -25,6 +29,221 @@ void test_is_blob()
     decref(value);
 }
 
+void test_blob_equals_across_sections()
+{
+    Value flat = from_str("hello world");
+    Value node = concat(from_str("hel"), from_str("lo world"));
+    Value nested = concat(concat(from_str("h"), from_str("ello ")), from_str("world"));
+    Value sliced = byte_slice(from_str("  hello world  "), 2, 11);
+
+    expect(equals(flat, node));
+    expect(equals(node, nested));
+    expect(equals(nested, sliced));
+    expect(equals(sliced, flat));
+
+    Value shorter = from_str("hello worl");
+    Value different = concat(from_str("hello "), from_str("worle"));
+    expect(!equals(flat, shorter));
+    expect(!equals(nested, different));
+
+    decref3(flat, node, nested);
+    decref3(sliced, shorter, different);
+}
+
+void test_blob_equals_large()
+{
+    u32 size = 60000;
+    Value flat = ptr_value(new_flat(BLOB_TYPE, size));
+    for (u32 i=0; i < size; i++)
+        flat.flat->data[i] = (u8) (i * 7);
+
+    Value rope = empty_blob();
+    for (u32 pos=0; pos < size; pos += 1000)
+        rope = append_bytes_len(rope, flat.flat->data + pos, 1000);
+
+    expect(equals(flat, rope));
+    expect(equals(rope, flat));
+
+    Value changed = set_logical_type(flatten(incref(rope)), BLOB_TYPE);
+    changed.flat->data[size - 1]++;
+    expect(!equals(flat, changed));
+
+    decref3(flat, rope, changed);
+}
+
+void test_blob_builder()
+{
+    BlobBuilder builder;
+    blob_builder_start(&builder, 4);
+
+    Value expected = empty_blob();
+    for (int i=0; i < 500; i++) {
+        char str[16];
+        int len = snprintf(str, 16, "%d,", i);
+        blob_builder_append(&builder, (const u8*) str, len);
+        expected = append_str_len(expected, str, len);
+    }
+    blob_builder_append_u8(&builder, '!');
+    blob_builder_append_blob(&builder, expected);
+    expected = concat(expected, concat(from_str("!"), incref(expected)));
+
+    Value result = blob_builder_finish(&builder);
+    expect(is_flat_block(result));
+    expect(is_blob(result));
+    expect(equals(result, expected));
+    decref2(result, expected);
+
+    blob_builder_start(&builder, 0);
+    expect(is_empty_blob(blob_builder_finish(&builder)));
+}
+
+void test_blob_builder_limit()
+{
+    BlobBuilder builder;
+    blob_builder_start(&builder, 16);
+
+    // Fill to 10 bytes short of the limit, then reserve more than is left.
+    u8 chunk[1000];
+    memset(chunk, 'a', sizeof(chunk));
+    u32 size = 0;
+    while (size + sizeof(chunk) <= MAX_BLOB_SIZE - 10) {
+        blob_builder_append(&builder, chunk, sizeof(chunk));
+        size += sizeof(chunk);
+    }
+    u32 left = MAX_BLOB_SIZE - size;
+
+    u8* dest = blob_builder_reserve(&builder, left + 20);
+    memset(dest, 'b', left);
+    expect(blob_builder_commit(&builder, left));
+
+    Value full = blob_builder_finish(&builder);
+    expect(block_size(full) == MAX_BLOB_SIZE);
+    expect(*block_get(full, MAX_BLOB_SIZE - 1) == 'b');
+    decref(full);
+
+    // Committing past the limit fails the builder.
+    blob_builder_start(&builder, 16);
+    while (size > 0) {
+        blob_builder_append(&builder, chunk, sizeof(chunk));
+        size -= sizeof(chunk);
+    }
+    dest = blob_builder_reserve(&builder, 2 * left);
+    expect(!blob_builder_commit(&builder, 2 * left));
+    blob_builder_append_u8(&builder, 'c');
+    expect(is_nil(blob_builder_finish(&builder)));
+
+    // So does appending past it.
+    blob_builder_start(&builder, 16);
+    for (int i=0; i < 70; i++)
+        blob_builder_append(&builder, chunk, sizeof(chunk));
+    expect(builder.failed);
+    expect(is_nil(blob_builder_finish(&builder)));
+}
+
+void test_stringify_is_one_flat()
+{
+    Value list = empty_list();
+    for (int i=0; i < 300; i++)
+        list = append(list, list2(int_value(i), from_str("x")));
+
+    Value str = stringify(list);
+    expect(is_flat_block(str));
+    expect(block_size(str) > 3000);
+    expect(memcmp(str.flat->data, "[[0, \"x\"], [1, \"x\"]", 19) == 0);
+    expect(memcmp(str.flat->data + block_size(str) - 11, "[299, \"x\"]]", 11) == 0);
+
+    decref2(list, str);
+}
+
+static void count_free(void* ptr, void* context)
+{
+    (*(int*) context)++;
+    free(ptr);
+}
+
+void test_blob_from_external()
+{
+    int free_count = 0;
+    u8* buffer = malloc(11);
+    memcpy(buffer, "hello world", 11);
+
+    Value blob = blob_from_external(buffer, 11, count_free, &free_count);
+    expect(is_external_block(blob));
+    expect(is_blob(blob));
+    expect_str(blob, "hello world");
+
+    Value flat = from_str("hello world");
+    expect(equals(blob, flat));
+    expect(hashcode(blob) == hashcode(flat));
+
+    Value world = byte_slice(incref(blob), 6, 5);
+    Value joined = concat(from_str("big "), incref(world));
+    expect_str(joined, "big world");
+
+    decref3(blob, flat, joined);
+    expect(free_count == 0);
+    decref(world);
+    expect(free_count == 1);
+
+    expect(is_empty_blob(blob_from_external(malloc(1), 0, count_free, &free_count)));
+    expect(free_count == 2);
+
+    // Too large: nil, and the caller keeps the buffer.
+    u8* large = malloc(MAX_BLOB_SIZE + 1);
+    expect(is_nil(blob_from_external(large, MAX_BLOB_SIZE + 1, count_free, &free_count)));
+    expect(free_count == 2);
+    free(large);
+}
+
+static Value read_back(FILE* file)
+{
+    fflush(file);
+    rewind(file);
+
+    Value result = empty_blob();
+    char buf[4096];
+    size_t count;
+    while ((count = fread(buf, 1, sizeof(buf), file)) > 0)
+        result = append_str_len(result, buf, count);
+    return result;
+}
+
+void test_write_value()
+{
+    Value value = list3(int_value(1), from_str("two"), list2(float_value(0.5), nil_value()));
+
+    FILE* file = tmpfile();
+    expect(write_value(fileno(file), value));
+    Value written = read_back(file);
+    Value expected = stringify(value);
+    expect(equals(written, expected));
+    fclose(file);
+    decref3(value, written, expected);
+}
+
+void test_write_value_larger_than_buffer()
+{
+    // The text is far bigger than the write buffer, and than one blob can hold.
+    Value list = empty_list();
+    for (int i=0; i < 5000; i++)
+        list = append(list, int_value(1000000 + i));
+    Value big = ptr_value(new_flat(BLOB_TYPE, 20000));
+    memset(big.flat->data, 'x', 20000);
+    list = append(list, big);
+
+    FILE* file = tmpfile();
+    expect(write_value(fileno(file), list));
+    fseek(file, 0, SEEK_END);
+    expect(ftell(file) == 1 + 5000 * 9 + 2 + 20000 + 1);
+    fseek(file, 0, SEEK_SET);
+
+    char head[18];
+    expect(fread(head, 1, 17, file) == 17);
+    expect(memcmp(head, "[1000000, 1000001", 17) == 0);
+    fclose(file);
+    decref(list);
+}
+
 // OLD
 
 #if 0
@@ -142,6 +361,14 @@ void test_blob_slice()
 void blob_test()
 {
     test_case(test_is_blob);
+    test_case(test_blob_equals_across_sections);
+    test_case(test_blob_equals_large);
+    test_case(test_blob_builder);
+    test_case(test_blob_builder_limit);
+    test_case(test_stringify_is_one_flat);
+    test_case(test_blob_from_external);
+    test_case(test_write_value);
+    test_case(test_write_value_larger_than_buffer);
 
 #if 0
     test_case(test_blob_equals_string);
@@ -0,0 +1,424 @@
+
+// For mkstemp() and sigaction()
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ice_internal_headers.h"
+
+#include "test_framework.h"
+
+#include "blob.h"
+#include "block.h"
+#include "file.h"
+#include "hash.h"
+#include "list.h"
+#include "parallel.h"
+#include "value.h"
+
+static int temp_file(char* path)
+{
+    strcpy(path, "/tmp/ice_file_test_XXXXXX");
+    int fd = mkstemp(path);
+    expect(fd >= 0);
+    return fd;
+}
+
+static Value read_all(int fd)
+{
+    lseek(fd, 0, SEEK_SET);
+
+    Value result = empty_blob();
+    char buf[4096];
+    ssize_t count;
+    while ((count = read(fd, buf, sizeof(buf))) > 0)
+        result = append_str_len(result, buf, count);
+    return result;
+}
+
+void test_write_blob()
+{
+    char path[32];
+    int fd = temp_file(path);
+
+    Value blob = concat(from_str("hello "), byte_slice(from_str("big world"), 4, 5));
+    expect(write_blob(fd, blob));
+    expect(write_blob(fd, empty_blob()));
+
+    Value written = read_all(fd);
+    expect_str(written, "hello world");
+
+    close(fd);
+    unlink(path);
+    decref2(blob, written);
+}
+
+void test_write_blob_many_sections()
+{
+    char path[32];
+    int fd = temp_file(path);
+
+    // More sections than one writev batch.
+    Value blob = empty_blob();
+    for (int i=0; i < 3000; i++)
+        blob = append_u8(blob, 'a' + i % 26);
+
+    expect(write_blob(fd, blob));
+
+    Value written = read_all(fd);
+    expect(block_size(written) == 3000);
+    expect(equals(written, blob));
+
+    close(fd);
+    unlink(path);
+    decref2(blob, written);
+}
+
+void test_write_blob_error()
+{
+    Value blob = from_str("x");
+    expect(!write_blob(-1, blob));
+    decref(blob);
+}
+
+static Value write_temp_file(char* path, u32 size)
+{
+    int fd = temp_file(path);
+    Flat* flat = new_flat(BLOB_TYPE, size);
+    for (u32 i=0; i < size; i++)
+        flat->data[i] = (u8) (i * 13 + i / 256);
+    Value contents = ptr_value(flat);
+    expect(write_blob(fd, contents));
+    close(fd);
+    return contents;
+}
+
+void test_read_file()
+{
+    u32 sizes[] = { 0, 1, 100, 16384, 16385, 50000, 0xffff };
+
+    for (u32 i=0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        char path[32];
+        Value expected = write_temp_file(path, sizes[i]);
+
+        Value chunked = read_file(from_str(path));
+        expect(is_blob(chunked));
+        expect(equals(chunked, expected));
+        if (sizes[i] > 16384)
+            expect(is_node_block(chunked));
+
+        Value single = read_file_with_flags(from_str(path), READ_SINGLE_FLAT);
+        expect(equals(single, expected));
+        expect(sizes[i] == 0 || is_flat_block(single));
+
+        unlink(path);
+        decref3(expected, chunked, single);
+    }
+}
+
+void test_read_file_too_large()
+{
+    char path[32];
+    int fd = temp_file(path);
+    u8 buf[1000];
+    memset(buf, 'z', sizeof(buf));
+    for (int i=0; i < 70; i++)
+        expect(write(fd, buf, sizeof(buf)) == sizeof(buf));
+    close(fd);
+
+    expect(is_nil(read_file(from_str(path))));
+    expect(is_nil(read_file_with_flags(from_str(path), READ_SINGLE_FLAT)));
+    unlink(path);
+
+    expect(is_nil(read_file(from_str("/nonexistent/ice_file_test"))));
+}
+
+void test_read_fd_pipe()
+{
+    int fds[2];
+    expect(pipe(fds) == 0);
+    expect(write(fds[1], "piped data", 10) == 10);
+    close(fds[1]);
+
+    Value contents = read_fd(fds[0], 0);
+    expect_str(contents, "piped data");
+    close(fds[0]);
+    decref(contents);
+}
+
+void test_read_file_mapped()
+{
+    char path[32];
+    Value expected = write_temp_file(path, 40000);
+
+    Value mapped = read_file_with_flags(from_str(path), READ_MAPPED);
+    unlink(path);
+
+    expect(is_mapped_block(mapped));
+    expect(is_blob(mapped));
+    expect(block_size(mapped) == 40000);
+    expect(equals(mapped, expected));
+    expect(equals(expected, mapped));
+    expect(hashcode(mapped) == hashcode(expected));
+    expect(*block_get(mapped, 12345) == expected.flat->data[12345]);
+
+    Value piece = byte_slice(incref(mapped), 100, 200);
+    Value expected_piece = byte_slice(incref(expected), 100, 200);
+    expect(equals(piece, expected_piece));
+
+    Value joined = concat(from_str("head:"), incref(piece));
+    Value flat = flatten(incref(joined));
+    expect(is_flat_block(flat));
+    expect(equals(flat, joined));
+    expect(memcmp(flat.flat->data + 5, expected.flat->data + 100, 200) == 0);
+
+    decref4(piece, expected_piece, joined, flat);
+    decref2(mapped, expected);
+}
+
+static Value read_test_file(const char* path)
+{
+    return read_file(from_str(path));
+}
+
+void test_write_file_if_different()
+{
+    char path[32];
+    close(temp_file(path));
+    unlink(path);
+
+    Value contents = concat(from_str("first "), from_str("version"));
+    expect(equals(write_file_if_different(from_str(path), contents), true_value()));
+    Value written = read_test_file(path);
+    expect(equals(written, contents));
+    decref(written);
+
+    // A new file gets the usual mode, and a replaced one keeps its own.
+    mode_t mask = umask(0);
+    umask(mask);
+    struct stat info;
+    expect(stat(path, &info) == 0 && (info.st_mode & 0777) == (0666 & ~mask));
+    expect(chmod(path, 0640) == 0);
+
+    // Same bytes, as a different rope.
+    Value same = from_str("first version");
+    expect(equals(write_file_if_different(from_str(path), same), false_value()));
+
+    // Same size, different bytes.
+    Value changed = from_str("first versioN");
+    expect(equals(write_file_if_different(from_str(path), changed), true_value()));
+    written = read_test_file(path);
+    expect(equals(written, changed));
+    decref(written);
+    expect(stat(path, &info) == 0 && (info.st_mode & 0777) == 0640);
+
+    Value shorter = from_str("short");
+    expect(equals(write_file_if_different(from_str(path), shorter), true_value()));
+    expect(equals(write_file_if_different(from_str(path), empty_blob()), true_value()));
+    expect(equals(write_file_if_different(from_str(path), empty_blob()), false_value()));
+
+    expect(is_nil(write_file_if_different(from_str("/nonexistent/dir/file"), shorter)));
+
+    unlink(path);
+    decref4(contents, same, changed, shorter);
+}
+
+void test_write_file_if_different_sidecar()
+{
+    char path[32];
+    close(temp_file(path));
+    unlink(path);
+    char sidecar[40];
+    snprintf(sidecar, sizeof(sidecar), "%s.hash", path);
+
+    Value contents = from_str("generated output");
+    expect(equals(write_file_if_different_with_flags(from_str(path), contents, WRITE_HASH_SIDECAR), true_value()));
+    expect(access(sidecar, F_OK) == 0);
+    expect(equals(write_file_if_different_with_flags(from_str(path), contents, WRITE_HASH_SIDECAR), false_value()));
+
+    // Replacing the file behind the cache's back is noticed.
+    char other[32];
+    int fd = temp_file(other);
+    expect(write(fd, "generated outpuT", 16) == 16);
+    close(fd);
+    expect(rename(other, path) == 0);
+
+    expect(equals(write_file_if_different_with_flags(from_str(path), contents, WRITE_HASH_SIDECAR), true_value()));
+    Value written = read_test_file(path);
+    expect(equals(written, contents));
+    expect(equals(write_file_if_different_with_flags(from_str(path), contents, WRITE_HASH_SIDECAR), false_value()));
+
+    unlink(path);
+    unlink(sidecar);
+    decref2(contents, written);
+}
+
+typedef struct ConcurrentWriter {
+    const char* path;
+    char fill;
+    int failures;
+} ConcurrentWriter;
+
+static void write_repeatedly(void* arg)
+{
+    ConcurrentWriter* writer = arg;
+
+    // Alternate between two contents, so that every call writes.
+    for (int i=0; i < 100; i++) {
+        Flat* flat = new_flat(BLOB_TYPE, 4000);
+        memset(flat->data, writer->fill + i % 2, 4000);
+        Value contents = ptr_value(flat);
+        if (is_nil(write_file_if_different(from_str(writer->path), contents)))
+            writer->failures++;
+        decref(contents);
+    }
+}
+
+void test_write_file_if_different_concurrent()
+{
+    char path[32];
+    close(temp_file(path));
+
+    // Both threads replace the same file over and over. Neither should trip over
+    // the other's temporary file.
+    ConcurrentWriter writers[2] = { { path, 'a', 0 }, { path, 'c', 0 } };
+    void* args[2] = { &writers[0], &writers[1] };
+    parallel_run(write_repeatedly, args, 2);
+
+    expect(writers[0].failures == 0);
+    expect(writers[1].failures == 0);
+
+    Value written = read_test_file(path);
+    expect(block_size(written) == 4000);
+    u8 first = *block_get(written, 0);
+    expect(first >= 'a' && first <= 'd');
+    for (u32 i=0; i < 4000; i++)
+        expect(*block_get(written, i) == first);
+
+    unlink(path);
+    decref(written);
+}
+
+void test_read_files()
+{
+    u32 sizes[] = { 10, 0, 70000, 20000, 1, 0xffff };
+    int count = sizeof(sizes) / sizeof(sizes[0]);
+    char paths[8][32];
+    Value expected[8];
+
+    Value path_list = empty_list();
+    for (int i=0; i < count; i++) {
+        if (sizes[i] > MAX_BLOB_SIZE) {
+            int fd = temp_file(paths[i]);
+            expect(ftruncate(fd, sizes[i]) == 0);
+            close(fd);
+            expected[i] = nil_value();
+        } else {
+            expected[i] = write_temp_file(paths[i], sizes[i]);
+        }
+        path_list = append(path_list, from_str(paths[i]));
+    }
+    path_list = append(path_list, from_str("/nonexistent/ice_file_test"));
+
+    Value results = read_files(incref(path_list));
+    expect(length(results) == (u32) count + 1);
+    for (int i=0; i < count; i++)
+        expect(equals(nth(results, i), expected[i]));
+    expect(is_nil(nth(results, count)));
+
+    // The thread pool fallback gives the same results.
+    const char* path_strs[8];
+    Value threaded[8];
+    for (int i=0; i < count; i++)
+        path_strs[i] = paths[i];
+    read_files_threaded(path_strs, threaded, count);
+    for (int i=0; i < count; i++) {
+        expect(equals(threaded[i], expected[i]));
+        decref(threaded[i]);
+    }
+
+    for (int i=0; i < count; i++) {
+        unlink(paths[i]);
+        decref(expected[i]);
+    }
+    decref2(path_list, results);
+}
+
+static bool g_stop_signals;
+
+static void ignore_signal(int sig)
+{
+    (void) sig;
+}
+
+static void* send_signals(void* target)
+{
+    while (!__atomic_load_n(&g_stop_signals, __ATOMIC_ACQUIRE)) {
+        pthread_kill(*(pthread_t*) target, SIGUSR1);
+        struct timespec delay = { 0, 50000 };
+        nanosleep(&delay, NULL);
+    }
+    return NULL;
+}
+
+void test_read_files_interrupted()
+{
+    // Signals interrupt the waits for completions (there's no SA_RESTART), so
+    // io_uring_enter keeps returning early while reads are in flight.
+    struct sigaction action;
+    struct sigaction previous;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = ignore_signal;
+    sigaction(SIGUSR1, &action, &previous);
+
+    enum { count = 200 };
+    char paths[count][32];
+    Value expected[count];
+    Value path_list = empty_list();
+    for (int i=0; i < count; i++) {
+        expected[i] = write_temp_file(paths[i], 1000 + i * 97);
+        path_list = append(path_list, from_str(paths[i]));
+    }
+
+    pthread_t self = pthread_self();
+    pthread_t sender;
+    __atomic_store_n(&g_stop_signals, false, __ATOMIC_RELEASE);
+    pthread_create(&sender, NULL, send_signals, &self);
+
+    for (int round=0; round < 5; round++) {
+        Value results = read_files(incref(path_list));
+        for (int i=0; i < count; i++)
+            expect(equals(nth(results, i), expected[i]));
+        decref(results);
+    }
+
+    __atomic_store_n(&g_stop_signals, true, __ATOMIC_RELEASE);
+    pthread_join(sender, NULL);
+    sigaction(SIGUSR1, &previous, NULL);
+
+    for (int i=0; i < count; i++) {
+        unlink(paths[i]);
+        decref(expected[i]);
+    }
+    decref(path_list);
+}
+
+void file_test()
+{
+    test_case(test_write_blob);
+    test_case(test_write_blob_many_sections);
+    test_case(test_write_blob_error);
+    test_case(test_read_file);
+    test_case(test_read_file_too_large);
+    test_case(test_read_fd_pipe);
+    test_case(test_read_file_mapped);
+    test_case(test_write_file_if_different);
+    test_case(test_write_file_if_different_sidecar);
+    test_case(test_write_file_if_different_concurrent);
+    test_case(test_read_files);
+    test_case(test_read_files_interrupted);
+}
@@ -0,0 +1,97 @@
+
+#include "ice_internal_headers.h"
+
+#include "test_framework.h"
+
+#include "blob.h"
+#include "block.h"
+#include "intern.h"
+#include "value.h"
+
+void test_intern_blobs()
+{
+    Value a = intern_value(from_str("apple"));
+    Value b = intern_value(concat(from_str("ap"), from_str("ple")));
+    Value c = intern_value(from_str("banana"));
+
+    expect(is_interned(a));
+    expect(shallow_equals(a, b));
+    expect(is_flat_block(b));
+    expect(refcount(a) == 2);
+    expect(!equals(a, c));
+
+    decref3(a, b, c);
+}
+
+void test_intern_list_items()
+{
+    Value a = intern_value(list2(from_str("x"), list1(int_value(1))));
+    Value b = intern_value(list2(from_str("y"), list1(int_value(1))));
+
+    expect(!shallow_equals(a, b));
+    expect(shallow_equals(nth(a, 1), nth(b, 1)));
+    expect(is_interned(nth(a, 0)));
+
+    Value c = intern_value(from_str("x"));
+    expect(shallow_equals(c, nth(a, 0)));
+
+    decref3(a, b, c);
+}
+
+void test_intern_is_weak()
+{
+    Value a = intern_value(from_str("temporary"));
+    Value b = intern_value(from_str("temporary"));
+    expect(refcount(a) == 2);
+    decref2(a, b);
+
+    // The last reference freed it, so this is a fresh block.
+    Value c = intern_value(from_str("temporary"));
+    expect(is_interned(c));
+    expect(refcount(c) == 1);
+    decref(c);
+}
+
+void test_intern_many()
+{
+    // Enough members to grow the table and exercise removal within probe chains.
+    Value items[200];
+    for (int i=0; i < 200; i++)
+        items[i] = intern_value(list1(int_value(i)));
+
+    for (int i=0; i < 200; i += 2)
+        decref(items[i]);
+
+    for (int i=1; i < 200; i += 2) {
+        Value again = intern_value(list1(int_value(i)));
+        expect(shallow_equals(again, items[i]));
+        decref2(again, items[i]);
+    }
+}
+
+void test_interned_blocks_are_not_written()
+{
+    Value a = intern_value(list2(int_value(1), int_value(2)));
+    Value b = set_nth(incref(a), 0, int_value(3));
+    expect_str(a, "[1, 2]");
+    expect_str(b, "[3, 2]");
+    expect(!shallow_equals(a, b));
+    expect(!is_interned(b));
+    decref2(a, b);
+}
+
+void test_intern_symbol()
+{
+    Value a = intern_value(set_logical_type(from_str("sym"), SYMBOL_TYPE));
+    expect(shallow_equals(a, symbol("sym")));
+}
+
+void intern_test()
+{
+    test_case(test_intern_blobs);
+    test_case(test_intern_list_items);
+    test_case(test_intern_is_weak);
+    test_case(test_intern_many);
+    test_case(test_interned_blocks_are_not_written);
+    test_case(test_intern_symbol);
+}
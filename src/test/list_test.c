@@ -190,16 +190,25 @@ void test_slice()
     Value e = slice(empty_list(), 0, 0);
     expect_str(e, "[]");
     decref5(base, a, b, c, d);
+    decref(e);
 }
 
 void test_reuse_slice_of_slice()
 {
     Value base = list3(int_value(1), int_value(2), int_value(3));
     Value a = slice(incref(base), 1, 2);
-    Value b = slice(a, 1, 1);
+    Value b = slice(incref(a), 1, 1);
     expect_str(a, "[2, 3]");
     expect_str(b, "[3]");
-    decref2(base, b);
+
+    // A size past the end of the outer slice is clipped to it.
+    Value c = byte_slice(incref(a), 8, 100);
+    expect_str(c, "[3]");
+
+    // 'b' refers to 'base' directly, so it outlives 'a'.
+    decref(a);
+    expect_str(b, "[3]");
+    decref3(base, b, c);
 }
 
 void test_simplify_slice_on_slice()
@@ -253,6 +262,70 @@ void test_set_nth_on_empty()
     decref(s);
 }
 
+void test_equals_across_sections()
+{
+    Value flat = list4(int_value(1), from_str("a"), list1(int_value(2)), nil_value());
+    Value node = concat(list2(int_value(1), from_str("a")),
+        list2(list1(int_value(2)), nil_value()));
+    Value sliced = slice(concat(list1(int_value(0)), list4(int_value(1), from_str("a"),
+        list1(int_value(2)), nil_value())), 1, 4);
+
+    expect(equals(flat, node));
+    expect(equals(node, sliced));
+    expect(equals(sliced, flat));
+
+    Value shorter = list3(int_value(1), from_str("a"), list1(int_value(2)));
+    Value different = list4(int_value(1), from_str("a"), list1(int_value(3)), nil_value());
+    expect(!equals(flat, shorter));
+    expect(!equals(node, different));
+
+    decref5(flat, node, sliced, shorter, different);
+}
+
+static Value balanced_concat(Value* items, int count)
+{
+    if (count == 1)
+        return incref(items[0]);
+    return concat(balanced_concat(items, count / 2),
+        balanced_concat(items + count / 2, count - count / 2));
+}
+
+void test_equals_shared_structure()
+{
+    // Two versions of a 64-leaf document that differ in one leaf.
+    Value leaves[64];
+    for (int i=0; i < 64; i++)
+        leaves[i] = range(i * 10, i * 10 + 10);
+
+    Value v1 = balanced_concat(leaves, 64);
+    Value v2 = balanced_concat(leaves, 64);
+
+    decref(leaves[40]);
+    leaves[40] = set_nth(range(400, 410), 9, int_value(0));
+    Value v3 = balanced_concat(leaves, 64);
+
+    hashcode(v1);
+    hashcode(v3);
+
+    perf_stats_reset();
+    expect(equals(v1, v2));
+    expect_stat_within(stat_equals_section, 0);
+
+    // Cached hashes differ.
+    perf_stats_reset();
+    expect(!equals(v1, v3));
+    expect_stat_within(stat_equals_section, 0);
+
+    // No hash on v2, so this descends the shared tree down to the changed leaf.
+    perf_stats_reset();
+    expect(!equals(v2, v3));
+    expect_stat_within(stat_equals_section, 1);
+
+    for (int i=0; i < 64; i++)
+        decref(leaves[i]);
+    decref3(v1, v2, v3);
+}
+
 void list_test()
 {
     test_case(test_empty_list);
@@ -276,4 +349,6 @@ void list_test()
     test_case(test_rest);
     test_case(test_set_nth);
     test_case(test_set_nth_on_empty);
+    test_case(test_equals_across_sections);
+    test_case(test_equals_shared_structure);
 }
@@ -4,6 +4,8 @@
 #include "test_framework.h"
 
 #include "blob.h"
+#include "block.h"
+#include "format.h"
 #include "primitive.h"
 #include "value.h"
 
@@ -16,14 +18,74 @@ void test_atoi()
     str = from_str("-51");
     expect(ice_atoi(str) == -51);
     decref(str);
+
+    str = from_str("42abc");
+    expect(ice_atoi(str) == 42);
+    decref(str);
+
+    // Digits split across sections.
+    str = concat(concat(from_str("-12"), from_str("345")), from_str("6789012,3"));
+    expect(ice_atoi(str) == -123456789012ll);
+    decref(str);
+
+    str = from_str("99999999999999999999");
+    expect(ice_atoi(str) == INT64_MAX);
+    decref(str);
+
+    str = from_str("-9223372036854775808");
+    expect(ice_atoi(str) == INT64_MIN);
+    decref(str);
 }
 
 void test_atof()
 {
-    return; // test disabled
     Value str = from_str("123.123");
     expect(fabs(ice_atof(str) - 123.123) < 0.0001);
     decref(str);
+
+    str = concat(from_str("-2.5e"), from_str("3x"));
+    expect(ice_atof(str) == -2500.0);
+    decref(str);
+
+    str = from_str("1e");
+    expect(ice_atof(str) == 1.0);
+    decref(str);
+}
+
+void test_atof_rounding()
+{
+    // Fast path and slow path inputs must both match strtod exactly.
+    const char* inputs[] = {
+        "0.1", "0.30000000000000004", "9007199254740993", "1e23", "8.5e-6",
+        "2.2250738585072014e-308", "4.9e-324", "1.7976931348623157e308", "1e400",
+        "123456789012345678901234567890", "0.000000000000000000000000000123",
+        "3.141592653589793238462643383279", "-0.0", "7e22", "12345e30",
+    };
+    int count = sizeof(inputs) / sizeof(inputs[0]);
+
+    for (int i=0; i < count; i++) {
+        // Split each input in two, to stream over sections.
+        u32 split = strlen(inputs[i]) / 2;
+        Value str = concat(append_str_len(empty_blob(), inputs[i], split),
+            from_str(inputs[i] + split));
+        f64 parsed = ice_atof(str);
+        f64 expected = strtod(inputs[i], NULL);
+        expect(memcmp(&parsed, &expected, sizeof(f64)) == 0);
+        decref(str);
+    }
+}
+
+void test_parse_ints()
+{
+    Value list = list4(from_str("12"), from_str("-7"), from_str("x"), from_str("3.5"));
+    list = concat(list, list3(from_str("99999999999"), concat(from_str("4"), from_str("2")),
+        int_value(5)));
+
+    Value ints = parse_ints(list);
+    expect_str(ints, "[12, -7, nil, nil, nil, 42, nil]");
+    decref(ints);
+
+    expect(is_empty_list(parse_ints(empty_list())));
 }
 
 void test_int_stringify()
@@ -31,11 +93,58 @@ void test_int_stringify()
     Value str = stringify(int_value(5));
     expect_str(str, "5");
     decref(str);
+
+    char buf[FORMAT_INT_MAX + 1];
+    buf[format_int(buf, -2147483648ll)] = 0;
+    expect(strcmp(buf, "-2147483648") == 0);
+    buf[format_int(buf, 1234567890123ll)] = 0;
+    expect(strcmp(buf, "1234567890123") == 0);
+    buf[format_int(buf, 0)] = 0;
+    expect(strcmp(buf, "0") == 0);
+}
+
+void test_float_stringify()
+{
+    struct { f32 value; const char* expected; } cases[] = {
+        { 0.5f, "0.5" }, { 1.0f, "1.0" }, { -2.5f, "-2.5" }, { 100.0f, "100.0" },
+        { 0.1f, "0.1" }, { 0.3f, "0.3" }, { 16777216.0f, "16777216.0" },
+        { 123456789.0f, "123456790.0" }, { 1e9f, "1e9" }, { 0.00001f, "0.00001" },
+        { 1.5e-6f, "1.5e-6" }, { 3.4028235e38f, "3.4028235e38" }, { 1.4e-45f, "1e-45" },
+        { -0.0f, "-0.0" }, { INFINITY, "inf" }, { -INFINITY, "-inf" }, { NAN, "nan" },
+    };
+
+    for (u32 i=0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        Value str = stringify(float_value(cases[i].value));
+        expect_str(str, cases[i].expected);
+        decref(str);
+    }
+
+    // Shortest output still parses back to the same bits.
+    u32 seed = 12345;
+    for (int i=0; i < 10000; i++) {
+        seed = seed * 1103515245 + 12345;
+        u32 bits = seed ^ (seed >> 16);
+        f32 value;
+        memcpy(&value, &bits, sizeof(value));
+        if (isnan(value) || isinf(value))
+            continue;
+
+        char buf[FORMAT_FLOAT_MAX + 1];
+        u32 length = format_float(buf, value);
+        expect(length <= FORMAT_FLOAT_MAX);
+        buf[length] = 0;
+
+        f32 parsed = strtof(buf, NULL);
+        expect(memcmp(&parsed, &value, sizeof(value)) == 0);
+    }
 }
 
 void primitives_test()
 {
     test_case(test_atoi);
     test_case(test_atof);
+    test_case(test_atof_rounding);
+    test_case(test_parse_ints);
     test_case(test_int_stringify);
+    test_case(test_float_stringify);
 }
@@ -0,0 +1,161 @@
+
+// For mkstemp()
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+
+#include "ice_internal_headers.h"
+
+#include "test_framework.h"
+
+#include "block.h"
+#include "value.h"
+
+static Value sample_value()
+{
+    Value table = empty_table();
+    table = set(table, symbol("name"), text_from_str("example"));
+    table = set(table, int_value(3), float_value(0.5));
+
+    Value blob = concat(from_str("hello "), from_str("world"));
+    return list3(table, blob, list3(nil_value(), true_value(), empty_blob()));
+}
+
+void test_serialize_round_trip()
+{
+    Value value = sample_value();
+    Value data = serialize(value);
+    expect(is_blob(data));
+
+    Value loaded = deserialize(data);
+    expect(equals(loaded, value));
+    expect_str(loaded, "[{:name \"example\", 3 0.5}, \"hello world\", [nil, true, '']]");
+
+    Value table = nth(loaded, 0);
+    expect(is_text(get(table, symbol("name"))));
+    expect(get(table, symbol("name")).raw != get(nth(value, 0), symbol("name")).raw);
+
+    decref2(value, loaded);
+}
+
+void test_serialize_non_objects()
+{
+    Value loaded = deserialize(serialize(int_value(-7)));
+    expect_str(loaded, "-7");
+
+    loaded = deserialize(serialize(empty_list()));
+    expect_str(loaded, "[]");
+}
+
+void test_serialize_keeps_sharing()
+{
+    Value blob = from_str("shared");
+    Value list = list2(incref(blob), incref(blob));
+    Value outer = list2(incref(list), list);
+
+    // 'shared', the inner list and the outer list.
+    Value data = flatten(serialize(outer));
+    u32 object_count;
+    memcpy(&object_count, leaf_data(data) + block_size(data) - 8, 4);
+    expect(object_count == 3);
+
+    Value loaded = deserialize(data);
+    expect(equals(loaded, outer));
+    expect(nth(loaded, 0).raw == nth(loaded, 1).raw);
+
+    Value inner = nth(loaded, 0);
+    expect(nth(inner, 0).raw == nth(inner, 1).raw);
+
+    decref3(blob, outer, loaded);
+}
+
+void test_serialize_rejects_malformed()
+{
+    Value value = sample_value();
+    Value data = flatten(serialize(value));
+    u32 size = block_size(data);
+
+    // Every truncation is rejected.
+    for (u32 cut=0; cut < size; cut += 8) {
+        Value loaded = deserialize(byte_slice(incref(data), 0, cut));
+        expect(is_nil(loaded));
+    }
+
+    // So is a bad version.
+    Flat* copy = new_flat(BLOB_TYPE, size);
+    memcpy(copy->data, data.flat->data, size);
+    copy->data[4] = 99;
+    expect(is_nil(deserialize(ptr_value(copy))));
+
+    // Both bytes of the version count.
+    copy = new_flat(BLOB_TYPE, size);
+    memcpy(copy->data, data.flat->data, size);
+    copy->data[5] = 1;
+    expect(is_nil(deserialize(ptr_value(copy))));
+
+    // And a forward reference: point the root's first item at the root itself.
+    copy = new_flat(BLOB_TYPE, size);
+    memcpy(copy->data, data.flat->data, size);
+    u64 root;
+    memcpy(&root, copy->data + size - 16, 8);
+    memcpy(copy->data + root + 8, &root, 8);
+    expect(is_nil(deserialize(ptr_value(copy))));
+
+    expect(is_nil(deserialize(int_value(1))));
+
+    decref2(value, data);
+}
+
+void test_serialize_too_large()
+{
+    // Nine distinct 8K blobs don't fit in one blob.
+    Value list = empty_list();
+    for (int i=0; i < 9; i++) {
+        Flat* flat = new_flat(BLOB_TYPE, 8192);
+        memset(flat->data, 'a' + i, 8192);
+        list = append(list, ptr_value(flat));
+    }
+
+    expect(is_nil(serialize(list)));
+    decref(list);
+}
+
+void test_load_serialized_file()
+{
+    char path[32];
+    strcpy(path, "/tmp/ice_serialize_test_XXXXXX");
+    int fd = mkstemp(path);
+    expect(fd >= 0);
+
+    Value value = sample_value();
+    expect(serialize_to_fd(fd, value));
+    close(fd);
+
+    Value loaded = load_serialized_file(from_str(path));
+    expect(equals(loaded, value));
+
+    // Blobs point into the mapped file.
+    Value blob = nth(loaded, 1);
+    expect(is_external_block(blob));
+
+    // The mapping outlives the rest of the loaded value.
+    incref(blob);
+    decref(loaded);
+    expect_str(blob, "hello world");
+    decref(blob);
+
+    expect(is_nil(load_serialized_file(from_str("/tmp/ice_serialize_test_missing"))));
+
+    unlink(path);
+    decref(value);
+}
+
+void serialize_test()
+{
+    test_case(test_serialize_round_trip);
+    test_case(test_serialize_non_objects);
+    test_case(test_serialize_keeps_sharing);
+    test_case(test_serialize_rejects_malformed);
+    test_case(test_serialize_too_large);
+    test_case(test_load_serialized_file);
+}
@@ -0,0 +1,251 @@
+
+#include "ice_internal_headers.h"
+
+#include "test_framework.h"
+
+#include "block.h"
+#include "parallel.h"
+#include "value.h"
+
+void test_compare_types()
+{
+    // One value of each type, in sorted order.
+    Value ordered[] = {
+        nil_value(),
+        false_value(),
+        true_value(),
+        int_value(-5),
+        int_value(3),
+        float_value(-1.5),
+        float_value(2.0),
+        from_str("abc"),
+        from_str("abd"),
+        symbol("a"),
+        list1(int_value(1)),
+        list2(int_value(1), int_value(0)),
+        table1(int_value(1), int_value(2)),
+    };
+    int count = sizeof(ordered) / sizeof(Value);
+
+    for (int i=0; i < count; i++) {
+        expect(compare(ordered[i], ordered[i]) == 0);
+        for (int j=i + 1; j < count; j++) {
+            expect(compare(ordered[i], ordered[j]) == -1);
+            expect(compare(ordered[j], ordered[i]) == 1);
+        }
+    }
+
+    for (int i=0; i < count; i++)
+        decref(ordered[i]);
+}
+
+void test_compare_blobs()
+{
+    Value a = from_str("apple");
+    Value b = concat(from_str("app"), from_str("lf"));
+    Value c = from_str("app");
+    Value d = concat(from_str("ap"), from_str("ple"));
+
+    expect(compare(a, b) == -1);
+    expect(compare(c, a) == -1);
+    expect(compare(a, d) == 0);
+
+    // Bytes are unsigned.
+    Value high = from_str("\xff");
+    expect(compare(a, high) == -1);
+
+    decref5(a, b, c, d, high);
+}
+
+void test_compare_floats()
+{
+    Value nan = float_value(NAN);
+    expect(compare(float_value(1.0), nan) == -1);
+    expect(compare(nan, float_value(INFINITY)) == 1);
+    expect(compare(nan, nan) == 0);
+    expect(compare(float_value(-0.0), float_value(0.0)) != 0);
+}
+
+void test_sort()
+{
+    Value list = list4(int_value(3), from_str("b"), int_value(1), from_str("a"));
+    list = concat(list, list2(true_value(), nil_value()));
+    list = sort(list);
+
+    expect(is_flat_block(list));
+    expect_str(list, "[nil, true, 1, 3, \"a\", \"b\"]");
+    decref(list);
+
+    expect(is_empty_list(sort(empty_list())));
+}
+
+void test_sort_does_not_modify_shared()
+{
+    Value list = list3(int_value(3), int_value(2), int_value(1));
+    Value sorted = sort(incref(list));
+
+    expect_str(list, "[3, 2, 1]");
+    expect_str(sorted, "[1, 2, 3]");
+    expect(!equals(list, sorted));
+
+    decref2(list, sorted);
+}
+
+static Value by_first(Value a, Value b)
+{
+    return int_value(compare(nth(a, 0), nth(b, 0)));
+}
+
+void test_sort_by_is_stable()
+{
+    // Many equal keys, across several merge runs.
+    Value list = empty_list();
+    for (int i=0; i < 200; i++)
+        list = append(list, list2(int_value((i * 7) % 5), int_value(i)));
+
+    list = sort_by(list, by_first);
+
+    for (int i=1; i < 200; i++) {
+        Value prev = nth(list, i - 1);
+        Value item = nth(list, i);
+        expect(nth(prev, 0).i <= nth(item, 0).i);
+        if (nth(prev, 0).i == nth(item, 0).i)
+            expect(nth(prev, 1).i < nth(item, 1).i);
+    }
+
+    decref(list);
+}
+
+void test_sort_ints_radix()
+{
+    Value list = empty_list();
+    u32 seed = 12345;
+    for (int i=0; i < 1000; i++) {
+        seed = seed * 1103515245 + 12345;
+        list = append(list, int_value((i32) seed));
+    }
+    list = append(list, int_value(-2147483647 - 1));
+    list = append(list, int_value(2147483647));
+
+    perf_stats_reset();
+    list = sort(list);
+    expect_stat_within(stat_sort_radix, 1);
+
+    expect(nth(list, 0).i == -2147483647 - 1);
+    expect(nth(list, length(list) - 1).i == 2147483647);
+    for (u32 i=1; i < length(list); i++)
+        expect(nth(list, i - 1).i <= nth(list, i).i);
+
+    decref(list);
+}
+
+void test_sort_parallel()
+{
+    // Floats and blobs, long enough to be split across threads.
+    u32 count = 6000;
+    Flat* flat = new_flat(LIST_TYPE, sizeof(Value) * count);
+    u32 seed = 777;
+    for (u32 i=0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        char str[16];
+        snprintf(str, 16, "%u", seed % 1000);
+        ((Value*) flat->data)[i] = (i % 3 == 0) ? float_value(seed % 5000) : from_str(str);
+    }
+    Value list = ptr_value(flat);
+
+    parallel_set_thread_count(1);
+    Value expected = sort(incref(list));
+
+    parallel_set_thread_count(4);
+    perf_stats_reset();
+    Value sorted = sort(incref(list));
+    expect_stat_within(stat_sort_parallel, 1);
+    parallel_set_thread_count(0);
+
+    expect(equals(sorted, expected));
+    for (u32 i=1; i < count; i++)
+        expect(compare(nth(sorted, i - 1), nth(sorted, i)) <= 0);
+
+    decref3(list, expected, sorted);
+}
+
+static Value descending(Value a, Value b)
+{
+    return int_value(compare(b, a));
+}
+
+static Value pseudo_random_list(int count, int modulo)
+{
+    Value list = empty_list();
+    u32 seed = 99;
+    for (int i=0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        list = append(list, list2(int_value((seed >> 8) % modulo), int_value(i)));
+    }
+    return list;
+}
+
+void test_top_k()
+{
+    Value list = list4(int_value(5), int_value(1), int_value(4), int_value(2));
+    list = concat(list, list3(int_value(3), int_value(0), int_value(9)));
+
+    Value smallest = top_k(incref(list), 3, NULL);
+    expect_str(smallest, "[0, 1, 2]");
+
+    Value largest = top_k(incref(list), 2, descending);
+    expect_str(largest, "[9, 5]");
+
+    Value all = top_k(incref(list), 100, NULL);
+    expect_str(all, "[0, 1, 2, 3, 4, 5, 9]");
+
+    Value none = top_k(list, 0, NULL);
+    expect(is_empty_list(none));
+
+    decref3(smallest, largest, all);
+}
+
+void test_top_k_matches_stable_sort()
+{
+    Value list = pseudo_random_list(300, 20);
+    Value top = top_k(incref(list), 25, by_first);
+    Value sorted = sort_by(list, by_first);
+
+    expect(length(top) == 25);
+    for (int i=0; i < 25; i++)
+        expect(equals(nth(top, i), nth(sorted, i)));
+
+    decref2(top, sorted);
+}
+
+void test_nth_sorted()
+{
+    Value list = pseudo_random_list(300, 20);
+    Value sorted = sort_by(incref(list), by_first);
+
+    for (int i=0; i < 300; i += 7) {
+        Value item = nth_sorted(incref(list), i, by_first);
+        expect(equals(item, nth(sorted, i)));
+        decref(item);
+    }
+
+    expect(is_nil(nth_sorted(incref(list), 300, NULL)));
+    expect(nth_sorted(list3(int_value(3), int_value(1), int_value(2)), 1, NULL).i == 2);
+
+    decref2(list, sorted);
+}
+
+void sort_test()
+{
+    test_case(test_compare_types);
+    test_case(test_compare_blobs);
+    test_case(test_compare_floats);
+    test_case(test_sort);
+    test_case(test_sort_does_not_modify_shared);
+    test_case(test_sort_by_is_stable);
+    test_case(test_sort_ints_radix);
+    test_case(test_sort_parallel);
+    test_case(test_top_k);
+    test_case(test_top_k_matches_stable_sort);
+    test_case(test_nth_sorted);
+}
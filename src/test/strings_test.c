@@ -3,15 +3,99 @@
 
 #include "test_framework.h"
 
+#include "block.h"
 #include "strings.h"
 
-#if 0
 void test_string_split()
 {
     Value items = string_split(from_str("a b c"),
             from_str(" "));
-    expect_str(items, "[\"a\", \"b\"]");
+    expect_str(items, "[\"a\", \"b\", \"c\"]");
     decref(items);
+
+    items = string_split(from_str(",x,,y,"), from_str(","));
+    expect_str(items, "['', \"x\", '', \"y\", '']");
+    decref(items);
+
+    items = string_split(from_str("none"), from_str(" "));
+    expect_str(items, "[\"none\"]");
+    decref(items);
+}
+
+void test_string_split_is_zero_copy()
+{
+    Value source = from_str("key=value; other=thing");
+    Value items = string_split(incref(source), from_str("; "));
+    expect_str(items, "[\"key=value\", \"other=thing\"]");
+
+    // Pieces of pieces still point at the source.
+    Value fields = string_split(incref(nth(items, 1)), from_str("="));
+    expect_str(fields, "[\"other\", \"thing\"]");
+    expect(is_slice_block(nth(fields, 1)));
+    expect(shallow_equals(nth(fields, 1).slice->base, source));
+
+    decref3(source, items, fields);
+}
+
+void test_string_split_across_sections()
+{
+    // The separator straddles the sections.
+    Value str = concat(concat(from_str("ab-"), from_str("-cd-")), from_str("-ef"));
+    Value items = string_split(str, concat(from_str("-"), from_str("-")));
+    expect_str(items, "[\"ab\", \"cd\", \"ef\"]");
+    decref(items);
+}
+
+void test_string_join()
+{
+    Value a = string_join(list3(from_str("a"), from_str("b"), from_str("c")), from_str(", "));
+    expect_str(a, "a, b, c");
+
+    Value b = string_join(list1(from_str("one")), from_str(", "));
+    expect_str(b, "one");
+
+    Value c = string_join(empty_list(), from_str(", "));
+    expect_str(c, "");
+
+    // Splitting then joining gives back the original.
+    Value d = string_join(string_split(from_str("x::y::::z"), from_str("::")), from_str("::"));
+    expect_str(d, "x::y::::z");
+
+    decref4(a, b, c, d);
+}
+
+void test_split_text()
+{
+    Value items = string_split(text_from_str("\xc3\xa9,\xc3\xa0"), from_str(","));
+    expect(length(items) == 2);
+    expect(is_text(nth(items, 0)));
+    expect(char_length(nth(items, 1)) == 1);
+    decref(items);
+
+    // A continuation byte on its own isn't a code point boundary.
+    Value text = text_from_str("\xc3\xa9t\xc3\xa9");
+    items = string_split(incref(text), from_str("\xa9"));
+    expect(length(items) == 1);
+    expect(equals(nth(items, 0), text));
+    decref2(text, items);
+}
+
+void test_split_join_too_large()
+{
+    // 20,000 pieces don't fit in one list. The pieces saturate the source's refcount,
+    // so it's made permanent and freed by hand.
+    Flat* flat = new_flat(BLOB_TYPE, 40000);
+    for (u32 i=0; i < 40000; i++)
+        flat->data[i] = (i % 2) ? ',' : 'a';
+    Value source = make_perm(ptr_value(flat));
+    expect(is_nil(string_split(source, from_str(","))));
+    free_perm(source);
+
+    // Nor do 40,000 bytes joined twice fit in one blob.
+    flat = new_flat(BLOB_TYPE, 40000);
+    memset(flat->data, 'a', 40000);
+    Value big = ptr_value(flat);
+    expect(is_nil(string_join(list2(incref(big), big), from_str(","))));
 }
 
 void test_upper_lower()
@@ -24,6 +108,145 @@ void test_upper_lower()
     decref2(a,b);
 }
 
+void test_upper_lower_sections()
+{
+    // Long enough for whole words, with every byte around the letter ranges, and a
+    // non-ASCII character that must pass through.
+    Value source = concat(from_str("@AZ[`az{ Content-Type: "), from_str("text/\xc3\xa9t\xc3\xa9"));
+    Value upper = string_upper(incref(source));
+    Value lower = string_lower(incref(source));
+
+    expect(is_flat_block(upper));
+    expect_str(upper, "@AZ[`AZ{ CONTENT-TYPE: TEXT/\xc3\xa9T\xc3\xa9");
+    expect_str(lower, "@az[`az{ content-type: text/\xc3\xa9t\xc3\xa9");
+    expect_str(source, "@AZ[`az{ Content-Type: text/\xc3\xa9t\xc3\xa9");
+
+    // An unshared flat is rewritten in place.
+    Value flat = from_str("in place");
+    Flat* block = flat.flat;
+    flat = string_upper(flat);
+    expect(flat.flat == block);
+    expect_str(flat, "IN PLACE");
+
+    decref4(source, upper, lower, flat);
+}
+
+void test_is_ascii()
+{
+    Value a = concat(from_str("plain ascii text"), from_str("!"));
+    Value b = concat(from_str("plain ascii text"), from_str("\xc3\xa9"));
+    expect(is_ascii(a));
+    expect(!is_ascii(b));
+    expect(is_ascii(empty_blob()));
+    decref2(a, b);
+}
+
+void test_replace_byte()
+{
+    Value a = string_replace_byte(concat(from_str("a_b_c_d_e_f"), from_str("_g")), '_', '-');
+    expect_str(a, "a-b-c-d-e-f-g");
+
+    // High bytes, and neighbours of the target, across a whole word and a tail.
+    u8 data[] = { 0xff, 0x7f, 0xff, 0x00, 0xff, 0xfe, 0xff, 0x01, 0xff, 0x80 };
+    u8 expected[] = { '.', 0x7f, '.', 0x00, '.', 0xfe, '.', 0x01, '.', 0x80 };
+    Value b = string_replace_byte(append_bytes_len(empty_blob(), data, sizeof(data)), 0xff, '.');
+    for (u32 i=0; i < sizeof(data); i++)
+        expect(*block_get(b, i) == expected[i]);
+
+    decref2(a, b);
+}
+
+void test_replace_byte_text()
+{
+    // Sixty code points, so the text has an index.
+    Value text = empty_blob();
+    for (int i=0; i < 30; i++)
+        text = append_str(text, "\xc3\xa9-");
+    text = text_from_blob(text);
+    expect(char_length(text) == 60);
+
+    // ASCII for ASCII, in place.
+    Value a = string_replace_byte(incref(text), '-', '+');
+    expect(is_text(a));
+    expect(char_length(a) == 60);
+    expect(char_at(a, 59) == '+');
+
+    // 'é' to 'è' is still valid, and the index is rebuilt.
+    Value b = string_replace_byte(incref(text), 0xa9, 0xa8);
+    expect(is_text(b));
+    expect(char_length(b) == 60);
+    expect(char_at(b, 58) == 0xe8);
+
+    // Half of each 'é' isn't.
+    expect(is_nil(string_replace_byte(incref(text), 0xc3, '-')));
+    expect(is_nil(string_replace_byte(text, '-', 0xff)));
+
+    decref2(a, b);
+}
+
+void test_find()
+{
+    Value a = from_str("GET /index.html HTTP/1.1\r\nHost: example.com\r\n\r\n");
+    Value crlf = from_str("\r\n");
+    Value blank = from_str("\r\n\r\n");
+    Value missing = from_str("Accept");
+
+    expect(find(a, crlf, 0) == 24);
+    expect(find(a, crlf, 25) == 43);
+    expect(find(a, blank, 0) == 43);
+    expect(find(a, missing, 0) == -1);
+    expect(find(crlf, a, 0) == -1);
+    expect(contains(a, blank));
+    expect(!contains(a, missing));
+
+    // Offsets work with byte_slice.
+    Value line = byte_slice(incref(a), 0, find(a, crlf, 0));
+    expect_str(line, "GET /index.html HTTP/1.1");
+
+    decref5(a, crlf, blank, missing, line);
+}
+
+void test_find_across_sections()
+{
+    // A rope of one-byte and three-byte sections; every match straddles somewhere.
+    const char* text = "abaabababcabaabcabcabcab";
+    Value rope = empty_blob();
+    for (int i=0; text[i] != 0; ) {
+        int size = (i % 2 == 0) ? 1 : 3;
+        if (text[i + 1] == 0 || (size == 3 && (text[i + 2] == 0 || text[i + 3] == 0)))
+            size = 1;
+        rope = append_str_len(rope, text + i, size);
+        i += size;
+    }
+
+    const char* needles[] = { "a", "ab", "abc", "cab", "babc", "abaab", "bcabcabcab", "abd" };
+    for (int n=0; n < 8; n++) {
+        Value needle = from_str(needles[n]);
+        for (u32 start=0; start < strlen(text); start++) {
+            const char* expected = strstr(text + start, needles[n]);
+            int expected_offset = expected == NULL ? -1 : (int) (expected - text);
+            expect(find(rope, needle, start) == expected_offset);
+        }
+        decref(needle);
+    }
+
+    decref(rope);
+}
+
+void test_find_any()
+{
+    Value a = concat(from_str("name = "), from_str("value; other"));
+    Value delimiters = from_str(";=");
+    Value space = from_str(" ");
+
+    expect(find_any(a, delimiters, 0) == 5);
+    expect(find_any(a, delimiters, 6) == 12);
+    expect(find_any(a, delimiters, 13) == -1);
+    expect(find_any(a, space, 5) == 6);
+
+    decref3(a, delimiters, space);
+}
+
 void test_trim()
 {
     Value a = string_trim(from_str("  a  "));
@@ -37,13 +260,22 @@ void test_trim()
 
     decref4(a,b,c,d);
 }
-#endif
 
 void strings_test()
 {
-#if 0
     test_case(test_string_split);
+    test_case(test_string_split_is_zero_copy);
+    test_case(test_string_split_across_sections);
+    test_case(test_string_join);
+    test_case(test_split_text);
+    test_case(test_split_join_too_large);
     test_case(test_upper_lower);
+    test_case(test_upper_lower_sections);
+    test_case(test_is_ascii);
+    test_case(test_replace_byte);
+    test_case(test_replace_byte_text);
+    test_case(test_find);
+    test_case(test_find_across_sections);
+    test_case(test_find_any);
     test_case(test_trim);
-#endif
 }
@@ -4,6 +4,10 @@
 #include "test_framework.h"
 
 #include "blob.h"
+#include "block.h"
+#include "intern.h"
+#include "symbol.h"
+#include "value.h"
 
 void symbol_test_equals()
 {
@@ -11,10 +15,53 @@ void symbol_test_equals()
     expect_str(a, ":if");
     Value b = symbol("if");
     expect_equals(a, b);
+    expect(shallow_equals(a, b));
     expect(hashcode(a) == hashcode(b));
     decref2(a,b);
 }
 
+void test_symbol_interned()
+{
+    Value a = symbol("else");
+    Value b = symbol("elsewhere");
+    Value c = symbol("");
+    expect(is_interned(a));
+    expect(!equals(a, b));
+    expect(!equals(a, c));
+    expect(shallow_equals(c, symbol("")));
+
+    // A blob with the same bytes is still a different value.
+    Value blob = from_str("else");
+    expect(!equals(a, blob));
+    expect(!is_interned(blob));
+    decref(blob);
+}
+
+void test_equals_symbol()
+{
+    Value a = symbol("if");
+    expect(equals_symbol(a, "if"));
+    expect(!equals_symbol(a, "i"));
+    expect(!equals_symbol(a, "iff"));
+
+    Value blob = from_str("if");
+    expect(!equals_symbol(blob, "if"));
+    expect(!equals_symbol(int_value(1), "if"));
+    decref(blob);
+
+    // Symbols that aren't flats.
+    static u8 bytes[] = "foo";
+    Value external = set_logical_type(blob_from_external(bytes, 3, NULL, NULL), SYMBOL_TYPE);
+    expect(equals_symbol(external, "foo"));
+    expect(!equals_symbol(external, "fob"));
+    decref(external);
+
+    Value rope = set_logical_type(concat(from_str("fo"), from_str("o")), SYMBOL_TYPE);
+    expect(equals_symbol(rope, "foo"));
+    expect(!equals_symbol(rope, "fox"));
+    decref(rope);
+}
+
 void test_gensym()
 {
     Value a1 = gensym(from_str("a"));
@@ -27,12 +74,20 @@ void test_gensym()
     expect(shallow_equals(a1, a1));
     expect(shallow_equals(a1, a1c));
     expect(shallow_equals(a2, a2));
+    expect(is_interned(a1));
+    expect(is_symbol(a1));
+
+    Value name = stringify(a1);
+    Value same = symbol_from_bytes(block_get(name, 1), block_size(name) - 1);
+    expect(shallow_equals(a1, same));
 
-    decref3(a1, a2, a1c);
+    decref4(a1, a2, a1c, name);
 }
 
 void symbol_test()
 {
     test_case(symbol_test_equals);
+    test_case(test_symbol_interned);
+    test_case(test_equals_symbol);
     test_case(test_gensym);
 }
@@ -151,6 +151,77 @@ void test_take_value()
     decref3(val, table, a);
 }
 
+void test_from_pairs()
+{
+    Value pairs = list3(list2(int_value(1), int_value(2)),
+        list2(symbol("a"), from_str("b")),
+        list2(list1(int_value(3)), int_value(4)));
+    Value t = table_from_pairs(pairs);
+    expect_str(t, "{1 2, :a \"b\", [3] 4}");
+    expect(length(t) == 3);
+    expect_str(get(t, int_value(1)), "2");
+    Value key = list1(int_value(3));
+    expect_str(get(t, key), "4");
+    expect_str(get(t, int_value(5)), "nil");
+    decref2(t, key);
+
+    expect(is_empty_table(table_from_pairs(empty_list())));
+}
+
+void test_from_pairs_duplicates()
+{
+    Value pairs = list4(list2(int_value(1), int_value(2)),
+        list2(int_value(3), int_value(4)),
+        list2(int_value(1), int_value(5)),
+        list2(int_value(1), int_value(6)));
+    Value t = table_from_pairs(pairs);
+    expect_str(t, "{1 6, 3 4}");
+    expect(length(t) == 2);
+    expect_str(get(t, int_value(1)), "6");
+    expect_str(get(t, int_value(3)), "4");
+
+    // Index is still usable after growing.
+    t = set(t, int_value(7), int_value(8));
+    expect_str(t, "{1 6, 3 4, 7 8}");
+    expect_str(get(t, int_value(3)), "4");
+    expect_str(get(t, int_value(7)), "8");
+    decref(t);
+}
+
+void test_from_arrays()
+{
+    Value ks[100];
+    Value vs[100];
+    for (int i=0; i < 100; i++) {
+        ks[i] = list1(int_value(i));
+        vs[i] = int_value(i * 2);
+    }
+
+    Value t = table_from_arrays(ks, vs, 100);
+    expect(length(t) == 100);
+
+    for (int i=0; i < 100; i++) {
+        Value key = list1(int_value(i));
+        expect_equals(get(t, key), int_value(i * 2));
+        decref(key);
+    }
+
+    decref(t);
+}
+
+void test_table_n()
+{
+    Value t = table3(symbol("a"), int_value(1), symbol("b"), int_value(2),
+        symbol("c"), int_value(3));
+    expect_str(t, "{:a 1, :b 2, :c 3}");
+    decref(t);
+
+    t = table5(int_value(1), int_value(1), int_value(2), int_value(2), int_value(3),
+        int_value(3), int_value(4), int_value(4), int_value(5), int_value(5));
+    expect_str(t, "{1 1, 2 2, 3 3, 4 4, 5 5}");
+    decref(t);
+}
+
 void test_iterator()
 {
 #if 0
@@ -180,16 +251,82 @@ void test_iterator()
 #endif
 }
 
+void test_table_size_limit()
+{
+    enum { max = 4095 };
+    Value keys[max + 1];
+    Value vals[max + 1];
+    for (int i=0; i <= max; i++) {
+        keys[i] = int_value(i);
+        vals[i] = int_value(i * 2);
+    }
+
+    expect(is_nil(table_from_arrays(keys, vals, max + 1)));
+
+    Value full = table_from_arrays(keys, vals, max);
+    expect(length(full) == max);
+
+    // Replacing a value still fits, a new key doesn't.
+    Value replaced = set(incref(full), int_value(7), from_str("seven"));
+    expect(length(replaced) == max);
+    expect_str(get(replaced, int_value(7)), "seven");
+    expect(is_nil(set(replaced, int_value(max), int_value(0))));
+
+    // More pairs than fit, but few distinct keys.
+    Value pairs = empty_list();
+    for (int i=0; i < 5000; i++)
+        pairs = append(pairs, list2(int_value(i % 10), int_value(i)));
+    Value small = table_from_pairs(pairs);
+    expect(length(small) == 10);
+    expect_str(get(small, int_value(3)), "4993");
+
+    decref2(full, small);
+}
+
+void test_equals_any_order()
+{
+    Value a = table2(int_value(1), int_value(2), int_value(3), int_value(4));
+    Value b = table2(int_value(3), int_value(4), int_value(1), int_value(2));
+    expect(equals(a, b));
+    expect(hashcode(a) == hashcode(b));
+    expect(compare(a, b) == 0);
+
+    // Same keys, different values.
+    Value c = table2(int_value(3), int_value(4), int_value(1), int_value(5));
+    expect(!equals(a, c));
+    expect(hashcode(a) != hashcode(c));
+
+    // Nil values still need their key.
+    Value d = table2(int_value(1), nil_value(), int_value(3), int_value(4));
+    Value e = table2(int_value(3), int_value(4), int_value(2), nil_value());
+    expect(!equals(d, e));
+    expect(!equals(e, d));
+
+    // Pairs don't mix: swapping a key with its value is a different table.
+    Value f = table2(int_value(2), int_value(1), int_value(4), int_value(3));
+    expect(!equals(a, f));
+    expect(hashcode(a) != hashcode(f));
+
+    decref4(a, b, c, d);
+    decref2(e, f);
+}
+
 void table_test()
 {
     test_case(test_simple);
-#if 0
     test_case(test_simple_get);
     test_case(test_table_keys_and_values);
     test_case(test_safe_writes);
     test_case(test_grow);
     test_case(test_grow_ownership);
     test_case(test_as_list);
+    test_case(test_from_pairs);
+    test_case(test_from_pairs_duplicates);
+    test_case(test_from_arrays);
+    test_case(test_table_n);
+    test_case(test_table_size_limit);
+    test_case(test_equals_any_order);
+#if 0
     test_case(test_take_value);
     test_case(test_iterator);
 #endif
@@ -97,6 +97,84 @@ void test_hashcode_symbol()
     decref3(a,b,c);
 }
 
+void test_hashcode_is_cached()
+{
+    Value a = list3(int_value(1), int_value(2), int_value(3));
+    expect(a.object->hash == 0);
+    u32 hash = hashcode(a);
+    expect(a.object->hash != 0);
+    expect(hashcode(a) == hash);
+
+    // Nodes combine the cached hashes of their children.
+    Value b = concat(incref(a), list1(int_value(4)));
+    Value c = range(1, 5);
+    expect(hashcode(b) == hashcode(c));
+    expect(b.node->left.object->hash == a.object->hash);
+
+    // Writing in place resets the cached hash.
+    c = set_nth(c, 3, int_value(5));
+    expect(c.object->hash == 0);
+    expect(hashcode(b) != hashcode(c));
+
+    // A copy made for writing drops the cached hash, and a flattened copy keeps it.
+    Value d = writeable_flat(incref(a));
+    expect(d.raw != a.raw);
+    expect(d.object->hash == 0);
+    Value e = flatten(incref(b));
+    expect(e.object->hash == b.object->hash);
+
+    decref5(a, b, c, d, e);
+}
+
+void test_hashcode_order_sensitive()
+{
+    Value a = list2(int_value(1), int_value(2));
+    Value b = list2(int_value(2), int_value(1));
+    Value c = list2(int_value(3), int_value(3));
+    Value d = list2(int_value(4), int_value(4));
+    expect(hashcode(a) != hashcode(b));
+    expect(hashcode(c) != hashcode(d));
+    decref4(a, b, c, d);
+
+    a = from_str("ab");
+    b = from_str("ba");
+    c = from_str("a");
+    d = symbol("ab");
+    expect(hashcode(a) != hashcode(b));
+    expect(hashcode(a) != hashcode(c));
+    expect(hashcode(a) != hashcode(d));
+    decref4(a, b, c, d);
+}
+
+void test_hashcode_blob_representations()
+{
+    const char* str = "the quick brown fox jumps over the lazy dog";
+    Value flat = from_str(str);
+    Value sliced = byte_slice(from_str("__the quick brown fox jumps over the lazy dog__"), 2, strlen(str));
+    Value node = concat(concat(from_str("the quick "), from_str("brown fox")),
+        concat(from_str(" jumps over the lazy"), from_str(" dog")));
+
+    expect(equals(flat, sliced));
+    expect(equals(flat, node));
+    expect(hashcode(flat) == hashcode(sliced));
+    expect(hashcode(flat) == hashcode(node));
+
+    Value empty = byte_slice(incref(flat), 0, 0);
+    expect(hashcode(empty) == hashcode(empty_blob()));
+
+    decref4(flat, sliced, node, empty);
+}
+
+void test_equals_primitives()
+{
+    expect(equals(float_value(1.5), float_value(1.5)));
+    expect(!equals(float_value(1.5), float_value(2.5)));
+    expect(!equals(nil_value(), true_value()));
+    expect(!equals(true_value(), false_value()));
+    expect(!equals(int_value(1), float_value(1.0)));
+    expect(!equals(empty_list(), empty_blob()));
+}
+
 void test_deep_replace()
 {
     expect_str(deep_replace(int_value(1), int_value(1), int_value(2)), "2");
@@ -141,6 +219,10 @@ void tagged_value_test()
     test_case(test_hashcode_primitives);
     test_case(test_hashcode_lists);
     test_case(test_hashcode_symbol);
+    test_case(test_hashcode_is_cached);
+    test_case(test_hashcode_order_sensitive);
+    test_case(test_hashcode_blob_representations);
+    test_case(test_equals_primitives);
     test_case(test_deep_replace);
     test_case(null_pointer_is_not_an_object);
     test_case(test_opaque_pointer);
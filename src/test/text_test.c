@@ -0,0 +1,206 @@
+
+#include "ice_internal_headers.h"
+
+#include "test_framework.h"
+
+#include "block.h"
+#include "text.h"
+#include "value.h"
+
+void test_text_ascii()
+{
+    Value a = text_from_str("plain ascii text");
+    expect(is_text(a));
+    expect(a.object->layout == TEXT_LAYOUT_ASCII);
+    expect(char_length(a) == 16);
+    expect(char_at(a, 0) == 'p');
+    expect(char_at(a, 15) == 't');
+    expect(char_at(a, 16) == -1);
+    expect_str(a, "\"plain ascii text\"");
+    decref(a);
+
+    Value empty = text_from_blob(empty_blob());
+    expect(is_text(empty));
+    expect(char_length(empty) == 0);
+    decref(empty);
+}
+
+void test_text_rejects_invalid()
+{
+    const char* invalid[] = {
+        "\x80",             // lone continuation
+        "\xc0\x80",         // overlong
+        "\xe0\x80\x80",     // overlong
+        "\xed\xa0\x80",     // surrogate
+        "\xf4\x90\x80\x80", // past U+10FFFF
+        "abc\xe2\x82",      // truncated
+        "\xff",
+    };
+    for (int i=0; i < 7; i++)
+        expect(is_nil(text_from_str(invalid[i])));
+
+    Value valid = text_from_str("\xf4\x8f\xbf\xbf \xed\x9f\xbf");
+    expect(char_length(valid) == 3);
+    expect(char_at(valid, 0) == 0x10ffff);
+    expect(char_at(valid, 2) == 0xd7ff);
+    decref(valid);
+}
+
+// Every code point of a long multilingual text, checked against a decoded copy.
+static int g_code_points[2000];
+static u32 g_code_point_count;
+
+static Value multilingual_text()
+{
+    const char* words[] = { "abc ", "\xc3\xa9t\xc3\xa9 ", "\xe6\x97\xa5\xe6\x9c\xac ",
+        "\xf0\x9f\x99\x82", "long ascii run here " };
+    const int word_points[][5] = { { 'a', 'b', 'c', ' ' }, { 0xe9, 't', 0xe9, ' ' },
+        { 0x65e5, 0x672c, ' ' }, { 0x1f642 }, { 0 } };
+    const int word_lengths[] = { 4, 4, 3, 1, 20 };
+
+    Value blob = empty_blob();
+    g_code_point_count = 0;
+    for (int i=0; i < 150; i++) {
+        int w = (i * 7) % 5;
+        blob = append_str(blob, words[w]);
+        for (int c=0; c < word_lengths[w]; c++)
+            g_code_points[g_code_point_count++] = w == 4 ? words[w][c] : word_points[w][c];
+    }
+    return text_from_blob(blob);
+}
+
+void test_text_index()
+{
+    Value text = multilingual_text();
+    expect(is_flat_block(text));
+    expect(text.object->layout == TEXT_LAYOUT_INDEXED);
+    expect(char_length(text) == g_code_point_count);
+
+    for (u32 i=0; i < g_code_point_count; i++)
+        expect(char_at(text, i) == g_code_points[i]);
+
+    // A copy keeps the index.
+    Value copy = writeable_flat(incref(text));
+    expect(copy.flat != text.flat);
+    expect(char_at(copy, g_code_point_count - 1) == g_code_points[g_code_point_count - 1]);
+
+    decref2(text, copy);
+}
+
+void test_text_slice()
+{
+    Value text = multilingual_text();
+
+    Value a = text_slice(incref(text), 100, 300);
+    expect(is_slice_block(a));
+    expect(char_length(a) == 300);
+    for (int i=0; i < 300; i++)
+        expect(char_at(a, i) == g_code_points[100 + i]);
+
+    // Slices of slices refer to the original text.
+    Value b = text_slice(incref(a), 50, 10);
+    expect(shallow_equals(b.slice->base, text));
+    for (int i=0; i < 10; i++)
+        expect(char_at(b, i) == g_code_points[150 + i]);
+
+    Value c = text_slice(incref(text), g_code_point_count - 2, 100);
+    expect(char_length(c) == 2);
+
+    decref4(text, a, b, c);
+}
+
+void test_text_concat()
+{
+    Value text = concat(text_from_str("\xc3\xa9t\xc3\xa9 "), text_from_str("\xe6\x97\xa5\xe6\x9c\xac"));
+    expect(is_text(text));
+    expect(char_length(text) == 6);
+    expect(char_at(text, 3) == ' ');
+    expect(char_at(text, 4) == 0x65e5);
+    expect(char_at(text, 5) == 0x672c);
+
+    Value tail = text_slice(text, 2, 3);
+    expect(char_length(tail) == 3);
+    expect(char_at(tail, 0) == 0xe9);
+    expect(char_at(tail, 2) == 0x65e5);
+    decref(tail);
+}
+
+void test_text_concat_external()
+{
+    // "日本 語" held outside the library.
+    static u8 bytes[] = "\xe6\x97\xa5\xe6\x9c\xac \xe8\xaa\x9e";
+    Value text = concat(text_from_str("h\xc3\xa9llo "), blob_from_external(bytes, 10, NULL, NULL));
+    expect(is_text(text));
+    expect(char_length(text) == 10);
+    expect(char_at(text, 1) == 0xe9);
+    expect(char_at(text, 6) == 0x65e5);
+    expect(char_at(text, 9) == 0x8a9e);
+
+    Value tail = text_slice(text, 7, 3);
+    expect(char_length(tail) == 3);
+    expect(char_at(tail, 0) == 0x672c);
+    expect(char_at(tail, 2) == 0x8a9e);
+    decref(tail);
+}
+
+void test_text_concat_blob()
+{
+    // A valid blob is counted with the text.
+    Value text = concat(text_from_str("\xc3\xa9t\xc3\xa9 "), from_str("\xe6\x97\xa5!"));
+    expect(is_text(text));
+    expect(char_length(text) == 6);
+    expect(char_at(text, 4) == 0x65e5);
+
+    text = append_str(text, "\xc3\xa9");
+    expect(char_length(text) == 7);
+    expect(char_at(text, 6) == 0xe9);
+
+    // An invalid one isn't accepted as text.
+    expect(is_nil(concat(text, from_str("\xff\xfe"))));
+    expect(is_nil(append_str(text_from_str("abc"), "\xe6\x97")));
+
+    // Nor is one that only becomes valid across its sections.
+    Value split = concat(from_str("\xe6"), from_str("\x97\xa5"));
+    text = concat(text_from_str("ab"), split);
+    expect(is_text(text));
+    expect(char_length(text) == 3);
+    expect(char_at(text, 2) == 0x65e5);
+    decref(text);
+}
+
+void test_text_rope_counts()
+{
+    // A balanced rope of many small pieces, alternating ASCII and two-byte chars.
+    enum { count = 500 };
+    Value parts[count];
+    for (int i=0; i < count; i++)
+        parts[i] = text_from_str(i % 2 == 0 ? "ab" : "\xc3\xa9");
+    Value text = concat_balanced(parts, count);
+
+    expect(is_node_block(text));
+    expect(text.node->char_count == count / 2 * 3);
+    expect(char_length(text) == count / 2 * 3);
+
+    for (u32 i=0; i < count / 2; i++) {
+        expect(char_at(text, i * 3) == 'a');
+        expect(char_at(text, i * 3 + 2) == 0xe9);
+    }
+
+    Value middle = text_slice(text, 302, 6);
+    expect(char_length(middle) == 6);
+    expect(char_at(middle, 0) == 0xe9);
+    expect(char_at(middle, 1) == 'a');
+    decref(middle);
+}
+
+void text_test()
+{
+    test_case(test_text_ascii);
+    test_case(test_text_rejects_invalid);
+    test_case(test_text_index);
+    test_case(test_text_slice);
+    test_case(test_text_concat);
+    test_case(test_text_concat_external);
+    test_case(test_text_concat_blob);
+    test_case(test_text_rope_counts);
+}
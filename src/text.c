@@ -0,0 +1,370 @@
+
+#include "ice_internal_headers.h"
+
+#include "block.h"
+#include "swar.h"
+#include "text.h"
+#include "value.h"
+
+static u32 index_entry_count(u32 char_count)
+{
+    return (char_count + TEXT_INDEX_STRIDE - 1) / TEXT_INDEX_STRIDE;
+}
+
+static TextIndex* text_index(Value text)
+{
+    assert(text.object->layout == TEXT_LAYOUT_INDEXED);
+    return (TextIndex*) (text.flat->data + text.flat->header.size);
+}
+
+static bool is_continuation(u8 c)
+{
+    return (c & 0xc0) == 0x80;
+}
+
+// Size of the valid UTF-8 sequence at 'data', or 0 if it's invalid. Rejects overlong
+// forms, surrogates, and code points past U+10FFFF.
+static u32 sequence_size(const u8* data, u32 remaining)
+{
+    u8 c = data[0];
+
+    if (c < 0x80)
+        return 1;
+    if (c < 0xc2)
+        return 0;
+
+    if (c < 0xe0) {
+        if (remaining < 2 || !is_continuation(data[1]))
+            return 0;
+        return 2;
+    }
+
+    if (c < 0xf0) {
+        if (remaining < 3 || !is_continuation(data[1]) || !is_continuation(data[2]))
+            return 0;
+        if (c == 0xe0 && data[1] < 0xa0)
+            return 0;
+        if (c == 0xed && data[1] >= 0xa0)
+            return 0;
+        return 3;
+    }
+
+    if (c < 0xf5) {
+        if (remaining < 4 || !is_continuation(data[1]) || !is_continuation(data[2])
+                || !is_continuation(data[3]))
+            return 0;
+        if (c == 0xf0 && data[1] < 0x90)
+            return 0;
+        if (c == 0xf4 && data[1] >= 0x90)
+            return 0;
+        return 4;
+    }
+
+    return 0;
+}
+
+// Size of a sequence that is already known to be valid.
+static u32 lead_size(u8 c)
+{
+    if (c < 0x80)
+        return 1;
+    if (c < 0xe0)
+        return 2;
+    if (c < 0xf0)
+        return 3;
+    return 4;
+}
+
+// Validate and count code points, skipping ASCII eight bytes at a time. If 'index'
+// is given, its entries are filled in.
+static bool scan_utf8(const u8* data, u32 size, u32* char_count, TextIndex* index)
+{
+    u32 i = 0;
+    u32 chars = 0;
+
+    while (i < size) {
+        if (i + 8 <= size && (load_u64(data + i) & BYTES_80) == 0) {
+            if (index != NULL) {
+                // The stride is at least 8, so a word holds at most one entry.
+                u32 next = index_entry_count(chars) * TEXT_INDEX_STRIDE;
+                if (next < chars + 8)
+                    index->offsets[next / TEXT_INDEX_STRIDE] = i + (next - chars);
+            }
+            i += 8;
+            chars += 8;
+            continue;
+        }
+
+        u32 len = sequence_size(data + i, size - i);
+        if (len == 0)
+            return false;
+        if (index != NULL && chars % TEXT_INDEX_STRIDE == 0)
+            index->offsets[chars / TEXT_INDEX_STRIDE] = i;
+        i += len;
+        chars++;
+    }
+
+    *char_count = chars;
+    return true;
+}
+
+// Count code points in valid UTF-8, by counting the bytes that aren't continuations.
+static u32 count_chars(const u8* data, u32 size)
+{
+    u32 chars = 0;
+    u32 i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        u64 word = load_u64(data + i);
+        u64 continuations = word & ~(word << 1) & BYTES_80;
+        chars += 8 - __builtin_popcountll(continuations);
+    }
+
+    for (; i < size; i++)
+        chars += !is_continuation(data[i]);
+
+    return chars;
+}
+
+static u32 skip_chars(const u8* data, u32 offset, u32 count)
+{
+    for (u32 i=0; i < count; i++)
+        offset += lead_size(data[offset]);
+    return offset;
+}
+
+static Value empty_text()
+{
+    Flat* flat = new_flat(TEXT_TYPE, 0);
+    flat->header.layout = TEXT_LAYOUT_ASCII;
+    return ptr_value(flat);
+}
+
+Value text_from_blob(Value blob)
+{
+    if (is_text(blob))
+        return blob;
+
+    if (!is_object(blob)) {
+        decref(blob);
+        return empty_text();
+    }
+
+    Value flat = writeable_flat(blob);
+    u32 size = block_size(flat);
+    u32 char_count;
+
+    if (!scan_utf8(flat.flat->data, size, &char_count, NULL)) {
+        decref(flat);
+        return nil_value();
+    }
+
+    flat.object->logical_type = TEXT_TYPE;
+
+    if (char_count == size) {
+        flat.object->layout = TEXT_LAYOUT_ASCII;
+        return flat;
+    }
+
+    u32 trailer_size = sizeof(TextIndex) + sizeof(u16) * index_entry_count(char_count);
+    flat.flat = realloc(flat.flat, sizeof(Flat) + size + trailer_size);
+    flat.object->layout = TEXT_LAYOUT_INDEXED;
+
+    TextIndex* index = text_index(flat);
+    index->char_count = char_count;
+    scan_utf8(flat.flat->data, size, &char_count, index);
+    return flat;
+}
+
+bool is_valid_utf8(const u8* data, u32 size)
+{
+    u32 char_count;
+    return scan_utf8(data, size, &char_count, NULL);
+}
+
+Value text_operand(Value value)
+{
+    if (!is_leaf_block(value))
+        return text_from_blob(value);
+
+    if (!is_valid_utf8(leaf_data(value), block_size(value))) {
+        decref(value);
+        return nil_value();
+    }
+    return value;
+}
+
+Value text_from_str(const char* str)
+{
+    return text_from_blob(from_str(str));
+}
+
+bool is_text(Value value)
+{
+    return is_object(value) && value.object->logical_type == TEXT_TYPE;
+}
+
+u32 text_trailer_size(Value text)
+{
+    if (text.object->layout != TEXT_LAYOUT_INDEXED)
+        return 0;
+    return sizeof(TextIndex) + sizeof(u16) * index_entry_count(text_index(text)->char_count);
+}
+
+// Code point counts and offsets within one leaf. A leaf without an index (such as a
+// blob, or a mapped or external block, concatenated onto text) is counted directly.
+
+static u32 leaf_char_length(Value leaf)
+{
+    switch (leaf.object->layout) {
+    case TEXT_LAYOUT_ASCII:
+        return block_size(leaf);
+    case TEXT_LAYOUT_INDEXED:
+        return text_index(leaf)->char_count;
+    default:
+        return count_chars(leaf_data(leaf), block_size(leaf));
+    }
+}
+
+static u32 leaf_byte_offset(Value leaf, u32 char_index)
+{
+    switch (leaf.object->layout) {
+    case TEXT_LAYOUT_ASCII:
+        return char_index;
+    case TEXT_LAYOUT_INDEXED: {
+        TextIndex* index = text_index(leaf);
+        if (char_index >= index->char_count)
+            return block_size(leaf);
+        u16 start = index->offsets[char_index / TEXT_INDEX_STRIDE];
+        return skip_chars(leaf_data(leaf), start, char_index % TEXT_INDEX_STRIDE);
+    }
+    default:
+        return skip_chars(leaf_data(leaf), 0, char_index);
+    }
+}
+
+static u32 leaf_char_index(Value leaf, u32 byte_offset)
+{
+    switch (leaf.object->layout) {
+    case TEXT_LAYOUT_ASCII:
+        return byte_offset;
+    case TEXT_LAYOUT_INDEXED: {
+        // Last entry at or before 'byte_offset'.
+        TextIndex* index = text_index(leaf);
+        u32 low = 0;
+        u32 high = index_entry_count(index->char_count);
+        while (high - low > 1) {
+            u32 mid = (low + high) / 2;
+            if (index->offsets[mid] <= byte_offset)
+                low = mid;
+            else
+                high = mid;
+        }
+        u32 start = index->offsets[low];
+        return low * TEXT_INDEX_STRIDE + count_chars(leaf_data(leaf) + start, byte_offset - start);
+    }
+    default:
+        return count_chars(leaf_data(leaf), byte_offset);
+    }
+}
+
+// Number of code points before 'byte_offset', which is on a code point boundary.
+//
+// Text nodes cache their code point count, so finding a position costs one step per
+// level of the rope, plus an index lookup in the leaf. A blob concatenated onto text
+// has no counts of its own and is counted directly.
+static u32 text_char_index(Value text, u32 byte_offset)
+{
+    switch (text.object->block_type) {
+    case FLAT_BLOCK:
+    case MAPPED_BLOCK:
+    case EXTERNAL_BLOCK:
+        return leaf_char_index(text, byte_offset);
+    case SLICE_BLOCK: {
+        Value base = text.slice->base;
+        u32 start = text.slice->start_pos;
+        return text_char_index(base, start + byte_offset) - text_char_index(base, start);
+    }
+    case NODE_BLOCK: {
+        Value left = text.node->left;
+        if (byte_offset < block_size(left))
+            return text_char_index(left, byte_offset);
+        return char_length(left) + text_char_index(text.node->right, byte_offset - block_size(left));
+    }
+    }
+    internal_error("text_char_index: unknown block type");
+    return 0;
+}
+
+// Byte offset of code point 'char_index', which is at most the length.
+static u32 text_byte_offset(Value text, u32 char_index)
+{
+    switch (text.object->block_type) {
+    case FLAT_BLOCK:
+    case MAPPED_BLOCK:
+    case EXTERNAL_BLOCK:
+        return leaf_byte_offset(text, char_index);
+    case SLICE_BLOCK: {
+        Value base = text.slice->base;
+        u32 start = text.slice->start_pos;
+        return text_byte_offset(base, text_char_index(base, start) + char_index) - start;
+    }
+    case NODE_BLOCK: {
+        Value left = text.node->left;
+        u32 left_chars = char_length(left);
+        if (char_index < left_chars)
+            return text_byte_offset(left, char_index);
+        return block_size(left) + text_byte_offset(text.node->right, char_index - left_chars);
+    }
+    }
+    internal_error("text_byte_offset: unknown block type");
+    return 0;
+}
+
+u32 char_length(Value text)
+{
+    if (!is_object(text))
+        return 0;
+    if (is_leaf_block(text))
+        return leaf_char_length(text);
+    if (is_node_block(text) && text.object->logical_type == TEXT_TYPE)
+        return text.node->char_count;
+    return text_char_index(text, block_size(text));
+}
+
+int char_at(Value text, u32 index)
+{
+    if (index >= char_length(text))
+        return -1;
+
+    u32 offset = text_byte_offset(text, index);
+    u8 lead = *block_get(text, offset);
+    u32 size = lead_size(lead);
+
+    static const u8 lead_masks[] = { 0, 0x7f, 0x1f, 0x0f, 0x07 };
+    int code_point = lead & lead_masks[size];
+    for (u32 i=1; i < size; i++)
+        code_point = (code_point << 6) | (*block_get(text, offset + i) & 0x3f);
+    return code_point;
+}
+
+Value text_slice(Value text, u32 start, u32 count)
+{
+    u32 length = char_length(text);
+    if (start > length)
+        start = length;
+    if (count > length - start)
+        count = length - start;
+
+    if (count == 0) {
+        decref(text);
+        return empty_text();
+    }
+    if (count == length)
+        return text;
+
+    u32 start_byte = text_byte_offset(text, start);
+    u32 size = text_byte_offset(text, start + count) - start_byte;
+
+    return byte_slice(text, start_byte, size);
+}
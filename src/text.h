@@ -0,0 +1,23 @@
+
+#pragma once
+
+// Text blocks are UTF-8, validated when created. A flat text is either all ASCII
+// (TEXT_LAYOUT_ASCII), where code points and bytes line up, or it is followed by a
+// TextIndex trailer (TEXT_LAYOUT_INDEXED) with the byte offset of every
+// TEXT_INDEX_STRIDE'th code point. Text nodes store their code point count, and
+// slices and nodes find code points through the blocks they refer to.
+
+#define TEXT_INDEX_STRIDE 32
+
+typedef struct PACKED TextIndex {
+    u16 char_count;
+    u16 offsets[]; // offsets[i] is the byte offset of code point i * TEXT_INDEX_STRIDE
+} TextIndex;
+
+bool is_text(Value value);
+u32 text_trailer_size(Value text);
+bool is_valid_utf8(const u8* data, u32 size);
+
+// Check a non-text operand before it's concatenated onto text. A leaf holding valid
+// UTF-8 is kept as it is; anything else goes through text_from_blob.
+Value text_operand(Value value /*consumed*/);
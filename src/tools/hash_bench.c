@@ -0,0 +1,150 @@
+
+// Distribution, collision and throughput benchmark for hashcode().
+//
+// Build and run with: make build/hash_bench && build/hash_bench
+
+#include <time.h>
+
+#include "ice_internal_headers.h"
+
+#include "block.h"
+#include "hash.h"
+#include "value.h"
+
+#define KEY_COUNT 65536
+#define BUCKET_BITS 12
+
+static int compare_u32(const void* a, const void* b)
+{
+    u32 left = *(const u32*) a;
+    u32 right = *(const u32*) b;
+    return (left > right) - (left < right);
+}
+
+// Report collisions between full hashcodes, and how evenly the low bits spread over
+// buckets (tables index by the low bits).
+static void report(const char* name, u32* hashes, int count)
+{
+    int bucket_count = 1 << BUCKET_BITS;
+    int* buckets = malloc(sizeof(int) * bucket_count);
+    memset(buckets, 0, sizeof(int) * bucket_count);
+
+    for (int i=0; i < count; i++)
+        buckets[hashes[i] & (bucket_count - 1)]++;
+
+    double expected = (double) count / bucket_count;
+    double chi_squared = 0;
+    int max_load = 0;
+    for (int i=0; i < bucket_count; i++) {
+        double diff = buckets[i] - expected;
+        chi_squared += diff * diff / expected;
+        if (buckets[i] > max_load)
+            max_load = buckets[i];
+    }
+
+    qsort(hashes, count, sizeof(u32), compare_u32);
+    int collisions = 0;
+    for (int i=1; i < count; i++)
+        if (hashes[i] == hashes[i - 1])
+            collisions++;
+
+    double expected_collisions = (double) count * (count - 1) / 2 / 4294967296.0;
+
+    printf("%-24s collisions = %5d (random: %.1f), chi^2 = %8.1f (df %d), max bucket = %d (mean %.1f)\n",
+        name, collisions, expected_collisions, chi_squared, bucket_count - 1, max_load, expected);
+
+    free(buckets);
+}
+
+static void bench_ints(u32* hashes)
+{
+    for (int i=0; i < KEY_COUNT; i++)
+        hashes[i] = hashcode(int_value(i));
+    report("ints", hashes, KEY_COUNT);
+}
+
+static void bench_decimal_strings(u32* hashes)
+{
+    for (int i=0; i < KEY_COUNT; i++) {
+        char str[16];
+        snprintf(str, 16, "%d", i);
+        Value blob = from_str(str);
+        hashes[i] = hashcode(blob);
+        decref(blob);
+    }
+    report("decimal strings", hashes, KEY_COUNT);
+}
+
+static void bench_sparse_bits(u32* hashes)
+{
+    // 64-byte zero strings with exactly two bits set.
+    u8 data[64];
+    int i = 0;
+    for (int a=0; a < 512 && i < KEY_COUNT; a++) {
+        for (int b=a + 1; b < 512 && i < KEY_COUNT; b++) {
+            memset(data, 0, 64);
+            data[a / 8] |= 1 << (a % 8);
+            data[b / 8] |= 1 << (b % 8);
+            hashes[i++] = hashcode_bytes(BLOB_TYPE, data, 64);
+        }
+    }
+    report("sparse bits", hashes, KEY_COUNT);
+}
+
+static void bench_int_pairs(u32* hashes)
+{
+    // Every [i, j] for i, j < 256, which includes every permutation and every [x, x].
+    for (int i=0; i < KEY_COUNT; i++) {
+        Value pair = list2(int_value(i / 256), int_value(i % 256));
+        hashes[i] = hashcode(pair);
+        decref(pair);
+    }
+    report("int pairs", hashes, KEY_COUNT);
+}
+
+static void bench_throughput()
+{
+    u32 size = 0xffff;
+    u8* data = malloc(size);
+    for (u32 i=0; i < size; i++)
+        data[i] = (u8) (i * 31);
+
+    int iterations = 2000;
+    u32 check = 0;
+    clock_t start = clock();
+    for (int i=0; i < iterations; i++)
+        check += hashcode_bytes(BLOB_TYPE, data, size);
+    double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    printf("throughput: %.0f MB/s (check %08x)\n",
+        (double) size * iterations / seconds / 1e6, check);
+
+    // Same content as a Flat and as a rope of 64 chunks must hash the same.
+    Flat* flat = new_flat(BLOB_TYPE, size);
+    memcpy(flat->data, data, size);
+    Value rope = empty_blob();
+    for (u32 pos=0; pos < size; pos += 1024) {
+        u32 len = size - pos < 1024 ? size - pos : 1024;
+        rope = append_bytes_len(rope, data + pos, len);
+    }
+
+    Value flat_value = ptr_value(flat);
+    printf("flat/rope consistent: %s\n", hashcode(flat_value) == hashcode(rope) ? "yes" : "NO");
+
+    decref2(flat_value, rope);
+    free(data);
+}
+
+int main(int argc, char** argv)
+{
+    u32* hashes = malloc(sizeof(u32) * KEY_COUNT);
+
+    bench_ints(hashes);
+    bench_decimal_strings(hashes);
+    bench_sparse_bits(hashes);
+    bench_int_pairs(hashes);
+    bench_throughput();
+
+    free(hashes);
+    return 0;
+}
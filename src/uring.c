@@ -0,0 +1,356 @@
+
+// For syscall() and struct statx
+#define _GNU_SOURCE
+
+#include "ice_internal_headers.h"
+
+#include "blob.h"
+#include "block.h"
+#include "file.h"
+#include "uring.h"
+
+#if defined(__linux__) && !defined(ICE_NO_IO_URING)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// A minimal io_uring, driven with the raw syscalls so there's no liburing dependency.
+//
+// Files are loaded in batches. For each batch, one submission opens and statx's
+// every file by path, and a second reads every file into a Flat of its exact size.
+// So a batch costs two round trips to the kernel, however many files are in it.
+
+#define URING_BATCH 64
+#define URING_ENTRIES (URING_BATCH * 2)
+
+typedef struct Uring {
+    int fd;
+
+    void* sq_ring;
+    void* cq_ring;
+    u32 sq_ring_size;
+    u32 cq_ring_size;
+    struct io_uring_sqe* sqes;
+    u32 sqes_size;
+
+    u32* sq_head;
+    u32* sq_tail;
+    u32* sq_mask;
+    u32* sq_array;
+    u32* cq_head;
+    u32* cq_tail;
+    u32* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    u32 pending;
+    bool failed;
+    bool abandoned;
+} Uring;
+
+static void uring_close(Uring* ring)
+{
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0)
+        close(ring->fd);
+}
+
+static bool uring_init(Uring* ring, u32 entries)
+{
+    memset(ring, 0, sizeof(Uring));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    // Fails with ENOSYS on old kernels, and EPERM where io_uring is disabled.
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+        return false;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && ring->cq_ring_size > ring->sq_ring_size)
+        ring->sq_ring_size = ring->cq_ring_size;
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        uring_close(ring);
+        return false;
+    }
+
+    if (single_mmap) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            uring_close(ring);
+            return false;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        uring_close(ring);
+        return false;
+    }
+
+    u8* sq = ring->sq_ring;
+    ring->sq_head = (u32*) (sq + params.sq_off.head);
+    ring->sq_tail = (u32*) (sq + params.sq_off.tail);
+    ring->sq_mask = (u32*) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (u32*) (sq + params.sq_off.array);
+
+    u8* cq = ring->cq_ring;
+    ring->cq_head = (u32*) (cq + params.cq_off.head);
+    ring->cq_tail = (u32*) (cq + params.cq_off.tail);
+    ring->cq_mask = (u32*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+    return true;
+}
+
+static struct io_uring_sqe* uring_next_sqe(Uring* ring, u8 opcode, u64 user_data)
+{
+    u32 tail = *ring->sq_tail;
+    u32 index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = user_data;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+    return sqe;
+}
+
+static bool uring_next_cqe(Uring* ring, u64* user_data, i32* result)
+{
+    u32 head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return false;
+
+    struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+typedef void (*completion_func)(void* context, u64 user_data, i32 result);
+
+// Submit everything queued, and pass each completion to 'on_complete'. Doesn't return
+// until every submitted entry has completed, since until then the kernel may still
+// write to their buffers. io_uring_enter can return early (on a signal, say) with
+// fewer completions than asked for, so completions are counted rather than assumed.
+//
+// Returns false if anything couldn't be submitted. If waiting fails outright, the
+// ring is marked abandoned: some entries may still be in flight, so the caller must
+// not free or reuse their buffers.
+static bool uring_submit_and_wait(Uring* ring, completion_func on_complete, void* context)
+{
+    u32 to_submit = ring->pending;
+    u32 in_flight = 0;
+    ring->pending = 0;
+
+    while (to_submit > 0) {
+        int submitted = syscall(__NR_io_uring_enter, ring->fd, to_submit, 0, 0, NULL, 0);
+        if (submitted < 0 && errno == EINTR)
+            continue;
+        if (submitted <= 0)
+            break;
+        to_submit -= submitted;
+        in_flight += submitted;
+    }
+
+    // Unsubmitted entries stay in the queue. The ring isn't used again, so they never
+    // run.
+    if (to_submit > 0)
+        ring->failed = true;
+
+    while (in_flight > 0) {
+        u64 user_data;
+        i32 result;
+        if (uring_next_cqe(ring, &user_data, &result)) {
+            on_complete(context, user_data, result);
+            in_flight--;
+            continue;
+        }
+
+        int waited = syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (waited < 0 && errno != EINTR) {
+            ring->failed = true;
+            ring->abandoned = true;
+            return false;
+        }
+    }
+
+    return to_submit == 0;
+}
+
+// Anything io_uring couldn't handle (an unsupported opcode on an older kernel, a
+// short read, a file that isn't regular) is read the ordinary way.
+static Value read_fallback(const char* path, int fd)
+{
+    if (fd < 0)
+        return read_path(path, 0);
+
+    lseek(fd, 0, SEEK_SET);
+    return read_fd(fd, 0);
+}
+
+// Everything the kernel writes to for one batch. It's on the heap so that it can be
+// leaked, rather than freed under the kernel, if the ring is abandoned.
+typedef struct Batch {
+    u32 count;
+    int fds[URING_BATCH];
+    struct statx stats[URING_BATCH];
+    bool stat_ok[URING_BATCH];
+    Flat* flats[URING_BATCH];
+    bool read_ok[URING_BATCH];
+} Batch;
+
+static void on_open_or_stat(void* context, u64 user_data, i32 result)
+{
+    Batch* batch = (Batch*) context;
+    u32 i = user_data / 2;
+    if (i >= batch->count)
+        return;
+
+    if (user_data % 2 == 0)
+        batch->fds[i] = result;
+    else
+        batch->stat_ok[i] = result == 0;
+}
+
+static void on_read(void* context, u64 user_data, i32 result)
+{
+    Batch* batch = (Batch*) context;
+    u32 i = user_data;
+    if (i >= batch->count || batch->flats[i] == NULL)
+        return;
+
+    batch->read_ok[i] = result == batch->flats[i]->header.size;
+}
+
+static void read_batch(Uring* ring, const char** paths, Value* results, u32 count)
+{
+    Batch* batch = malloc(sizeof(Batch));
+    batch->count = count;
+
+    for (u32 i=0; i < count; i++) {
+        batch->fds[i] = -1;
+        batch->stat_ok[i] = false;
+        batch->flats[i] = NULL;
+        batch->read_ok[i] = false;
+        results[i] = nil_value();
+
+        struct io_uring_sqe* open = uring_next_sqe(ring, IORING_OP_OPENAT, i * 2);
+        open->fd = AT_FDCWD;
+        open->addr = (u64) (uintptr_t) paths[i];
+        open->open_flags = O_RDONLY | O_CLOEXEC;
+
+        struct io_uring_sqe* stat = uring_next_sqe(ring, IORING_OP_STATX, i * 2 + 1);
+        stat->fd = AT_FDCWD;
+        stat->addr = (u64) (uintptr_t) paths[i];
+        stat->len = STATX_TYPE | STATX_SIZE;
+        stat->off = (u64) (uintptr_t) &batch->stats[i];
+    }
+
+    bool ok = uring_submit_and_wait(ring, on_open_or_stat, batch);
+
+    // Read every regular file of a known size straight into a Flat of that size.
+    u32 reads = 0;
+    for (u32 i=0; ok && i < count; i++) {
+        struct statx* stats = &batch->stats[i];
+        if (batch->fds[i] < 0 || !batch->stat_ok[i] || !S_ISREG(stats->stx_mode) || stats->stx_size == 0)
+            continue;
+        if (stats->stx_size > MAX_BLOB_SIZE) {
+            // Too large for one blob, the same as read_file.
+            close(batch->fds[i]);
+            batch->fds[i] = -2;
+            continue;
+        }
+
+        batch->flats[i] = new_flat(BLOB_TYPE, stats->stx_size);
+        struct io_uring_sqe* read = uring_next_sqe(ring, IORING_OP_READ, i);
+        read->fd = batch->fds[i];
+        read->addr = (u64) (uintptr_t) batch->flats[i]->data;
+        read->len = stats->stx_size;
+        read->off = 0;
+        reads++;
+    }
+
+    if (reads > 0)
+        uring_submit_and_wait(ring, on_read, batch);
+
+    if (ring->abandoned) {
+        // The kernel may still write to the batch, so it's leaked along with any
+        // open files, and everything is read again the ordinary way.
+        for (u32 i=0; i < count; i++)
+            results[i] = read_path(paths[i], 0);
+        return;
+    }
+
+    for (u32 i=0; i < count; i++) {
+        if (batch->read_ok[i])
+            results[i] = ptr_value(batch->flats[i]);
+        else if (batch->flats[i] != NULL)
+            free(batch->flats[i]);
+
+        if (batch->fds[i] == -2)
+            continue;
+        if (is_nil(results[i]))
+            results[i] = read_fallback(paths[i], batch->fds[i]);
+        if (batch->fds[i] >= 0)
+            close(batch->fds[i]);
+    }
+
+    free(batch);
+}
+
+bool read_files_uring(const char** paths, Value* results, u32 count)
+{
+    Uring ring;
+    if (!uring_init(&ring, URING_ENTRIES))
+        return false;
+
+    for (u32 start=0; start < count; start += URING_BATCH) {
+        u32 batch = count - start;
+        if (batch > URING_BATCH)
+            batch = URING_BATCH;
+
+        if (ring.failed) {
+            for (u32 i=start; i < start + batch; i++)
+                results[i] = read_path(paths[i], 0);
+            continue;
+        }
+
+        read_batch(&ring, paths + start, results + start, batch);
+    }
+
+    uring_close(&ring);
+    return true;
+}
+
+#else
+
+bool read_files_uring(const char** paths, Value* results, u32 count)
+{
+    return false;
+}
+
+#endif
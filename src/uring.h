@@ -0,0 +1,7 @@
+// Copyright (c) Andrew Fischer. See LICENSE file for license terms.
+
+#pragma once
+
+// Read each path into results[i] (nil on error), batching the opens and reads with
+// io_uring. Returns false without reading anything if io_uring isn't available.
+bool read_files_uring(const char** paths, Value* results, u32 count);
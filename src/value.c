@@ -1,13 +1,23 @@
 
+#include <unistd.h>
+
 #include "ice_internal_headers.h"
 
 #include "blob.h"
 #include "block.h"
+#include "file.h"
+#include "format.h"
+#include "intern.h"
 #include "list.h"
 #include "symbol.h"
 #include "table.h"
 #include "value.h"
 
+// Buffer size for streaming a value's text to a file.
+#define WRITE_BUFFER_SIZE 8192
+
+#define min(x,y) ((x) < (y) ? (x) : (y))
+
 void nullify(Value* value)
 {
     decref(*value);
@@ -47,10 +57,14 @@ void decref(Value value)
             value.object->refcount = 0;
         #endif
 
+        if (value.object->interned)
+            intern_release(value);
+
         switch (value.object->block_type) {
         case FLAT_BLOCK: {
             Flat* flat = value.flat;
-            if (flat->header.logical_type == LIST_TYPE) {
+            if (flat->header.logical_type == LIST_TYPE
+                    || flat->header.logical_type == TABLE_TYPE) {
                 assert((flat->header.size % sizeof(Value)) == 0);
                 for (u32 pos=0; pos < flat->header.size; pos += sizeof(Value)) {
                     Value el = *(Value*)(flat->data + pos);
@@ -69,6 +83,15 @@ void decref(Value value)
             decref(value.node->right);
             free(value.node);
             return;
+        case MAPPED_BLOCK:
+            unmap_region(value.mapped->region, value.mapped->region_size);
+            free(value.mapped);
+            return;
+        case EXTERNAL_BLOCK:
+            if (value.external->free_func != NULL)
+                value.external->free_func(value.external->data, value.external->context);
+            free(value.external);
+            return;
         }
         return;
     }
@@ -134,8 +157,9 @@ Value set_logical_type(Value value, u8 logical_type)
     assert(get_logical_type(value) != LIST_TYPE);
 
     if (is_object(value)) {
-        if (refcount(value) == 1) {
+        if (is_writeable_object(value)) {
             value.object->logical_type = logical_type;
+            value.object->hash = 0;
             return value;
         }
         
@@ -155,21 +179,25 @@ Value make_perm(Value value)
 
 void free_perm(Value value)
 {
+    if (is_interned(value))
+        return;
+
     if (is_object(value)) {
         value.object->refcount = 1;
         decref(value);
     }
 }
 
+// Interned blocks are shared by content, so they are never writeable.
 bool object_is_writeable(Value value)
 {
     assert(is_object(value));
-    return value.object->refcount == 1;
+    return value.object->refcount == 1 && !value.object->interned;
 }
 
 bool is_writeable_object(Value value)
 {
-    return is_object(value) && value.object->refcount == 1;
+    return is_object(value) && value.object->refcount == 1 && !value.object->interned;
 }
 
 int refcount(Value value)
@@ -198,87 +226,141 @@ bool equals_int(Value value, int i)
 
 bool equals_symbol(Value value, const char* str)
 {
-    //TODO
-    return false;
+    if (!is_symbol(value))
+        return false;
+
+    u32 size = strlen(str);
+    if (value.object->size != size)
+        return false;
+
+    // Symbols from symbol() are interned flats, but set_logical_type can make a
+    // symbol out of any block.
+    if (is_flat_block(value))
+        return memcmp(value.flat->data, str, size) == 0;
+
+    u32 offset = 0;
+    for_each_section(value, it) {
+        u32 section_size;
+        u8* section = iterator_get_section(&it, &section_size);
+        if (memcmp(section, str + offset, section_size) != 0) {
+            iterator_stop(&it);
+            return false;
+        }
+        offset += section_size;
+    }
+    return true;
 }
 
-bool equals(Value left, Value right)
+static bool items_equal(const Value* left, const Value* right, u32 count)
 {
-    if (shallow_equals(left, right))
-        return true;
-
-    u8 logical_type_left = get_logical_type(left);
-    u8 logical_type_right = get_logical_type(right);
+    for (u32 i=0; i < count; i++)
+        if (left[i].raw != right[i].raw && !equals(left[i], right[i]))
+            return false;
+    return true;
+}
 
-    if (logical_type_left != logical_type_right)
-        return false;
+// Walk both sides (which have the same size) section by section. Where two sections
+// overlap, the span is compared with memcmp; for lists, a span that differs is then
+// compared item by item, skipping items with the same raw word.
+static bool sections_equal(Value left, Value right, bool is_list_like)
+{
+    Iterator left_it = iterator_start(left);
+    Iterator right_it = iterator_start(right);
+    bool result = true;
 
-    switch (logical_type_left) {
-    case INT_TYPE:
-        return left.i == right.i;
-    
-    case LIST_TYPE: {
-        Iterator left_it = iterator_start(left);
-        Iterator right_it = iterator_start(right);
-        bool result = true;
+    while (!iterator_done(&left_it) && !iterator_done(&right_it)) {
+        u32 left_size, right_size;
+        u8* left_data = iterator_get_section(&left_it, &left_size);
+        u8* right_data = iterator_get_section(&right_it, &right_size);
+        u32 size = min(left_size, right_size);
 
-        while (!iterator_done(&left_it) && !iterator_done(&right_it)) {
+        stat_inc(stat_equals_section);
 
-            if (!equals(iterator_get_val(&left_it), iterator_get_val(&right_it))) {
+        if (left_data != right_data && memcmp(left_data, right_data, size) != 0) {
+            if (!is_list_like
+                    || !items_equal((Value*) left_data, (Value*) right_data, size / sizeof(Value))) {
                 result = false;
                 break;
             }
-
-            iterator_advance_val(&left_it);
-            iterator_advance_val(&right_it);
-        }
-
-        if (!iterator_done(&left_it)) {
-            iterator_stop(&left_it);
-            result = false;
         }
 
-        if (!iterator_done(&right_it)) {
-            iterator_stop(&right_it);
-            result = false;
-        }
-            
-        return result;
+        iterator_advance(&left_it, size);
+        iterator_advance(&right_it, size);
     }
 
-    case BLOB_TYPE:
-    case SYMBOL_TYPE: {
-        Iterator left_it = iterator_start(left);
-        Iterator right_it = iterator_start(right);
-        bool result = true;
+    if (!iterator_done(&left_it))
+        iterator_stop(&left_it);
+    if (!iterator_done(&right_it))
+        iterator_stop(&right_it);
 
-        while (!iterator_done(&left_it) && !iterator_done(&right_it)) {
+    return result;
+}
 
-            if (iterator_get_u8(&left_it) != iterator_get_u8(&right_it)) {
-                result = false;
-                break;
-            }
+static bool have_different_hashes(Value left, Value right)
+{
+    // The cached hash state is a function of the content alone.
+    return is_object(left) && is_object(right)
+        && left.object->hash != 0 && right.object->hash != 0
+        && left.object->hash != right.object->hash;
+}
 
-            iterator_advance(&left_it, 1);
-            iterator_advance(&right_it, 1);
-        }
+// Compare two blocks of the same logical type, skipping any part of the structure
+// that both sides share. Nodes that split at the same offset are compared child by
+// child, so when two versions share most of their tree, only the changed path is
+// walked. Cached hashes that differ reject early at every level.
+static bool blocks_equal(Value left, Value right, bool is_list_like)
+{
+    if (left.raw == right.raw)
+        return true;
 
-        if (!iterator_done(&left_it)) {
-            iterator_stop(&left_it);
-            result = false;
-        }
+    if (block_size(left) != block_size(right))
+        return false;
 
-        if (!iterator_done(&right_it)) {
-            iterator_stop(&right_it);
-            result = false;
-        }
-            
-        return result;
-    }
+    if (have_different_hashes(left, right))
+        return false;
+
+    if (is_node_block(left) && is_node_block(right)
+            && block_size(left.node->left) == block_size(right.node->left)) {
+        return blocks_equal(left.node->left, right.node->left, is_list_like)
+            && blocks_equal(left.node->right, right.node->right, is_list_like);
     }
 
-    assert(false);
-    return false;
+    if (is_slice_block(left) && is_slice_block(right)
+            && left.slice->base.raw == right.slice->base.raw
+            && left.slice->start_pos == right.slice->start_pos)
+        return true;
+
+    return sections_equal(left, right, is_list_like);
+}
+
+bool equals(Value left, Value right)
+{
+    if (shallow_equals(left, right))
+        return true;
+
+    // There's only one interned block for any content.
+    if (is_interned(left) && is_interned(right))
+        return false;
+
+    u8 logical_type_left = get_logical_type(left);
+    u8 logical_type_right = get_logical_type(right);
+
+    if (logical_type_left != logical_type_right)
+        return false;
+
+    switch (logical_type_left) {
+    case INT_TYPE:
+        return left.i == right.i;
+    case LIST_TYPE:
+        return blocks_equal(left, right, true);
+    case TABLE_TYPE:
+        return table_equals(left, right);
+    case 0:
+        // Floats, bools, nil and opaque pointers are equal only if shallow_equals.
+        return false;
+    default:
+        return blocks_equal(left, right, false);
+    }
 }
 
 bool equals_str(Value lhs, const char* str)
@@ -321,64 +403,18 @@ Value deep_replace(Value obj /*consumed*/, Value target, Value replacement)
     return obj;
 }
 
-u32 hashcode_raw(u8* data, size_t size)
-{
-    u32 result = 0;
-    int offset = 0;
-    for (size_t i=0; i < size; i++) {
-        char c = data[i];
-        result ^= c << (offset*3);
-        offset = (offset + 1) % 4;
-    }
-    return result;
-}
-
-u32 hashcode(Value val)
-{
-    u32 result = 0;
-
-    if (is_list(val)) {
-        result = (u32) (EX_TAG_EMPTY_LIST << 8);
-        u32 len = length(val);
-        for (int i=0; i < len; i++)
-            result ^= hashcode(nth(val, i));
-    } else if (is_blob(val) || is_symbol(val)) {
-        int offset = 0;
-        for_each_byte(val, it)  {
-            char c = iterator_get_u8(&it);
-            result ^= c << (offset*3);
-            offset = (offset + 1) % 4;
-        }
-    } else {
-        result = ((u32) val.raw) ^ (val.raw >> 32);
-    }
-
-    // Don't allow a hashcode of 0, since 0 has special meaning of "not computed".
-    result += (result == 0) * 1;
-    return result;
-}
-
 void print(Value value)
 {
     if (is_empty_blob(value)) {
         return;
     }
 
-    if (is_blob(value)) {
-        for_each_section(value, it) {
-            u32 len;
-            u8* section = iterator_get_section(&it, &len);
-            printf("%.*s", len, section);
-        }
-        return;
-    }
-
-    Value rep;
+    fflush(stdout);
 
-    rep = stringify(value);
-    assert(is_blob(rep));
-    print(rep);
-    decref(rep);
+    if (is_blob(value) || is_text(value))
+        write_blob(STDOUT_FILENO, value);
+    else
+        write_value(STDOUT_FILENO, value);
 }
 
 void println(Value value)
@@ -387,108 +423,137 @@ void println(Value value)
     printf("\n");
 }
 
-Value stringify_append(Value buf /*consumed*/, Value suffix)
+void stringify_to_builder(BlobBuilder* builder, Value value)
 {
-    assert(is_blob(buf));
-
-    switch (suffix.tag) {
+    switch (value.tag) {
     case TAG_OBJECT:
-        assert(suffix.object != NULL);
+        assert(value.object != NULL);
 
-        switch (suffix.object->logical_type) {
+        switch (value.object->logical_type) {
 
         case LIST_TYPE: {
             bool first = true;
-            buf = append_str_len(buf, "[", 1);
-            for_each_list_item(suffix, it) {
+            blob_builder_append_u8(builder, '[');
+            for_each_list_item(value, it) {
                 if (!first)
-                    buf = append_str_len(buf, ", ", 2);
-                buf = stringify_append(buf, iterator_get_val(&it));
+                    blob_builder_append(builder, (const u8*) ", ", 2);
+                stringify_to_builder(builder, iterator_get_val(&it));
+                first = false;
+            }
+            blob_builder_append_u8(builder, ']');
+            return;
+        }
+
+        case TABLE_TYPE: {
+            bool first = true;
+            bool is_key = true;
+            blob_builder_append_u8(builder, '{');
+            for_each_list_item(value, it) {
+                if (is_key && !first)
+                    blob_builder_append(builder, (const u8*) ", ", 2);
+                else if (!is_key)
+                    blob_builder_append_u8(builder, ' ');
+                stringify_to_builder(builder, iterator_get_val(&it));
                 first = false;
+                is_key = !is_key;
             }
-            buf = append_str_len(buf, "]", 1);
-            return buf;
+            blob_builder_append_u8(builder, '}');
+            return;
         }
 
         case BLOB_TYPE:
-            buf = append_str_len(buf, "\"", 1);
-            buf = concat(buf, incref(suffix));
-            buf = append_str_len(buf, "\"", 1);
-            return buf;
+        case TEXT_TYPE:
+            blob_builder_append_u8(builder, '"');
+            blob_builder_append_blob(builder, value);
+            blob_builder_append_u8(builder, '"');
+            return;
 
         case SYMBOL_TYPE:
-            buf = append_str_len(buf, ":", 1);
-            buf = concat(buf, incref(suffix));
-            return buf;
+            blob_builder_append_u8(builder, ':');
+            blob_builder_append_blob(builder, value);
+            return;
         }
 
         break;
 
     case TAG_OPAQUE_POINTER: {
-        char str[30];
-        snprintf(str, 30, "%p", as_opaque_pointer(suffix));
-        return append_str(buf, str);
+        char* dest = (char*) blob_builder_reserve(builder, 30);
+        blob_builder_commit(builder, snprintf(dest, 30, "%p", as_opaque_pointer(value)));
+        return;
     }
 
     case TAG_EX:
-        switch (suffix.extag) {
+        switch (value.extag) {
         case EX_TAG_NIL:
-            buf = append_str(buf, "nil");
-            return buf; {
-        }
+            blob_builder_append_str(builder, "nil");
+            return;
 
         case EX_TAG_INT: {
-            char str[30];
-            snprintf(str, 30, "%d", suffix.i);
-            return append_str(buf, str);
+            char* dest = (char*) blob_builder_reserve(builder, FORMAT_INT_MAX);
+            blob_builder_commit(builder, format_int(dest, value.i));
+            return;
         }
 
         case EX_TAG_FLOAT: {
-            char str[30];
-            snprintf(str, 30, "%f", suffix.f);
-            buf = append_str(buf, str);
-            return buf;
+            char* dest = (char*) blob_builder_reserve(builder, FORMAT_FLOAT_MAX);
+            blob_builder_commit(builder, format_float(dest, value.f));
+            return;
         }
 
         case EX_TAG_EMPTY_LIST:
-            buf = append_str(buf, "[]");
-            return buf;
+            blob_builder_append_str(builder, "[]");
+            return;
 
         case EX_TAG_EMPTY_TABLE:
-            buf = append_str(buf, "{}");
-            return buf;
+            blob_builder_append_str(builder, "{}");
+            return;
 
         case EX_TAG_EMPTY_BLOB:
-            buf = append_str(buf, "''");
-            return buf;
+            blob_builder_append_str(builder, "''");
+            return;
 
         case EX_TAG_TRUE:
-            buf = append_str(buf, "true");
-            return buf;
+            blob_builder_append_str(builder, "true");
+            return;
 
         case EX_TAG_FALSE:
-            buf = append_str(buf, "false");
-            return buf;
-
+            blob_builder_append_str(builder, "false");
+            return;
         }
         break;
     }
 
-    printf("error: unhandled type in stringify_append: ");
-    dump(suffix);
+    printf("error: unhandled type in stringify: ");
+    dump(value);
+}
+
+Value stringify_append(Value buf /*consumed*/, Value suffix)
+{
+    assert(is_blob(buf));
+    return concat(buf, stringify(suffix));
+}
 
-    return buf;
+bool write_value(int fd, Value value)
+{
+    BlobBuilder builder;
+    blob_builder_start_stream(&builder, fd, WRITE_BUFFER_SIZE);
+    stringify_to_builder(&builder, value);
+    return blob_builder_finish_stream(&builder);
 }
 
 Value stringify(Value value)
 {
-    return stringify_append(empty_blob(), value);
+    BlobBuilder builder;
+    blob_builder_start(&builder, 64);
+    stringify_to_builder(&builder, value);
+    return blob_builder_finish(&builder);
 }
 
 const char* logical_type_name(u8 logical_type)
 {
     switch (logical_type) {
     case LIST_TYPE: return "list";
+    case TABLE_TYPE: return "table";
     case BLOB_TYPE: return "blob";
     case SYMBOL_TYPE: return "symbol";
     case TEXT_TYPE: return "text";
@@ -527,6 +592,24 @@ void print_raw(Value value)
             printf("}");
             return;
         } 
+        case MAPPED_BLOCK: {
+            Mapped* mapped = value.mapped;
+            printf("mapped#%d{%s, rc = %d, size = %d, data = %p}",
+                managed_alloc_get_id(mapped),
+                logical_type_name(mapped->header.logical_type),
+                mapped->header.refcount, mapped->header.size, mapped->data);
+            return;
+        }
+
+        case EXTERNAL_BLOCK: {
+            External* external = value.external;
+            printf("external#%d{%s, rc = %d, size = %d, data = %p}",
+                managed_alloc_get_id(external),
+                logical_type_name(external->header.logical_type),
+                external->header.refcount, external->header.size, external->data);
+            return;
+        }
+
         case NODE_BLOCK: {
             Node* node = value.node;
             printf("node#%d{%s, rc = %d, size = %d, left = ",
@@ -585,23 +668,128 @@ void dump(Value value)
 
 static int compare_rank_based_on_type(Value val)
 {
-    if (is_bool(val))
+    if (is_nil(val))
+        return 0;
+    else if (is_bool(val))
         return 1;
     else if (is_int(val))
         return 2;
     else if (is_float(val))
         return 3;
-    else
+    else if (is_blob(val))
+        return 4;
+    else if (is_text(val))
         return 5;
+    else if (is_symbol(val))
+        return 6;
+    else if (is_list(val))
+        return 7;
+    else if (is_table(val))
+        return 8;
+    else
+        return 9;
+}
+
+static int compare_raw(Value left, Value right)
+{
+    return left.raw < right.raw ? -1 : 1;
+}
+
+static int compare_float(Value left, Value right)
+{
+    // NaNs sort after every number. Ties (such as 0.0 and -0.0) go by raw bits.
+    bool left_nan = isnan(left.f);
+    bool right_nan = isnan(right.f);
+    if (left_nan != right_nan)
+        return left_nan ? 1 : -1;
+    if (left.f < right.f)
+        return -1;
+    if (left.f > right.f)
+        return 1;
+    return compare_raw(left, right);
+}
+
+// Lexicographic order, walking both sides section by section. Blob spans are
+// compared with memcmp, and list spans item by item. A prefix sorts first.
+static int compare_sections(Value left, Value right, bool is_list_like)
+{
+    // Two flat blobs need no iterators, and so touch no refcounts.
+    if (!is_list_like && is_flat_block(left) && is_flat_block(right)) {
+        int c = memcmp(left.flat->data, right.flat->data, min(block_size(left), block_size(right)));
+        if (c != 0)
+            return (c > 0) - (c < 0);
+        if (block_size(left) == block_size(right))
+            return 0;
+        return block_size(left) < block_size(right) ? -1 : 1;
+    }
+
+    Iterator left_it = iterator_start(left);
+    Iterator right_it = iterator_start(right);
+    int result = 0;
+
+    while (result == 0 && !iterator_done(&left_it) && !iterator_done(&right_it)) {
+        u32 left_size, right_size;
+        u8* left_data = iterator_get_section(&left_it, &left_size);
+        u8* right_data = iterator_get_section(&right_it, &right_size);
+        u32 size = min(left_size, right_size);
+
+        if (is_list_like) {
+            Value* left_items = (Value*) left_data;
+            Value* right_items = (Value*) right_data;
+            for (u32 i=0; result == 0 && i < size / sizeof(Value); i++)
+                if (left_items[i].raw != right_items[i].raw)
+                    result = compare(left_items[i], right_items[i]);
+        } else if (left_data != right_data) {
+            int c = memcmp(left_data, right_data, size);
+            result = (c > 0) - (c < 0);
+        }
+
+        iterator_advance(&left_it, size);
+        iterator_advance(&right_it, size);
+    }
+
+    if (!iterator_done(&left_it))
+        iterator_stop(&left_it);
+    if (!iterator_done(&right_it))
+        iterator_stop(&right_it);
+
+    if (result == 0 && block_size(left) != block_size(right))
+        result = block_size(left) < block_size(right) ? -1 : 1;
+
+    return result;
 }
 
 int compare(Value left, Value right)
 {
-    if (equals(left, right))
+    if (shallow_equals(left, right))
         return 0;
 
-    // FIXME
-    return 0;
+    int left_rank = compare_rank_based_on_type(left);
+    int right_rank = compare_rank_based_on_type(right);
+    if (left_rank != right_rank)
+        return left_rank < right_rank ? -1 : 1;
+
+    switch (left_rank) {
+    case 1:
+        return is_truthy(left) ? 1 : -1;
+    case 2:
+        return left.i < right.i ? -1 : 1;
+    case 3:
+        return compare_float(left, right);
+    case 4:
+    case 5:
+    case 6:
+        return compare_sections(left, right, false);
+    case 7:
+        return compare_sections(left, right, true);
+    case 8:
+        // Tables with the same pairs in another order are equal.
+        if (table_equals(left, right))
+            return 0;
+        return compare_sections(left, right, true);
+    default:
+        return compare_raw(left, right);
+    }
 }
 
 bool is_leaf_value(Value value)
@@ -781,7 +969,7 @@ Value nth(Value list, int index)
         case LIST_TYPE:
             return *((Value*) block_get(list, sizeof(Value) * index));
         case TABLE_TYPE:
-            assert(false);
+            return table_value_by_index(list, index);
         default:
             return nil_value();
         }
@@ -811,9 +999,8 @@ Value get(Value obj, Value key)
     if (is_empty_table(obj))
         return nil_value();
 
-    if (is_hashtable(obj)) {
-        assert(false);
-    }
+    if (is_hashtable(obj))
+        return table_get(obj, key);
 
     return nil_value();
 }
@@ -856,16 +1043,13 @@ Value set_nth(Value obj, int index, Value el)
         return obj;
     }
 
-    if (refcount(obj) == 1 && is_flat_block(obj)) {
-        Value* dest = ((Value*) obj.flat->data) + index;
-        decref(*dest);
-        *dest = el;
-        check_value(*dest);
-        return obj;
-    }
+    obj = writeable_flat(obj);
 
-    assert(false);
-    return nil_value();
+    Value* dest = ((Value*) obj.flat->data) + index;
+    decref(*dest);
+    *dest = el;
+    check_value(*dest);
+    return obj;
 }
 
 Value apply_nth(Value list, int index, func_1 func)
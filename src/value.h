@@ -1,6 +1,8 @@
 
 #pragma once
 
+#include "blob.h"
+
 bool is_object(Value value);
 
 u8 get_logical_type(Value value);
@@ -12,4 +14,5 @@ bool is_writeable_object(Value value);
 int refcount(Value value);
 
 Value stringify_append(Value buf /*consumed*/, Value suffix);
+void stringify_to_builder(BlobBuilder* builder, Value value);
 